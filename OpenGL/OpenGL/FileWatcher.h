@@ -0,0 +1,114 @@
+#ifndef FILE_WATCHER_H
+#define FILE_WATCHER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//Reports files that were written since the last poll(). Never blocks.
+//On Linux the directories holding the files are watched with inotify, which also sees
+//editors that save by writing a new file and renaming it over the old one.
+//Elsewhere modification times are compared at most every POLL_INTERVAL milliseconds.
+class FileWatcher {
+public:
+	static const int POLL_INTERVAL = 250;
+
+	FileWatcher() {
+#ifdef __linux__
+		fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+	}
+
+	~FileWatcher() {
+#ifdef __linux__
+		if (fd >= 0) close(fd);
+#endif
+	}
+
+	//Paths are reported back exactly as given here
+	void add(string path) {
+		for (const File &file : files) {
+			if (file.path == path) return;
+		}
+
+		File file;
+		file.path = path;
+		size_t slash = path.find_last_of("/\\");
+		string directory = slash == string::npos ? "." : path.substr(0, slash + 1);
+		file.name = slash == string::npos ? path : path.substr(slash + 1);
+		file.modified = modificationTime(path);
+#ifdef __linux__
+		file.watch = fd >= 0 ? inotify_add_watch(fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) : -1;
+#endif
+		files.push_back(file);
+	}
+
+	vector<string> poll() {
+		vector<string> changed;
+#ifdef __linux__
+		if (fd >= 0) {
+			char buffer[4096];
+			ssize_t length;
+			while ((length = read(fd, buffer, sizeof(buffer))) > 0) {
+				for (ssize_t at = 0;at < length;) {
+					const inotify_event* event = (const inotify_event*)(buffer + at);
+					at += sizeof(inotify_event) + event->len;
+					if (event->len == 0) continue;
+
+					for (const File &file : files) {
+						if (file.watch == event->wd && file.name == event->name) report(changed, file.path);
+					}
+				}
+			}
+			return changed;
+		}
+#endif
+		chrono::steady_clock::time_point now = chrono::steady_clock::now();
+		if (chrono::duration_cast<chrono::milliseconds>(now - lastPoll).count() < POLL_INTERVAL) return changed;
+		lastPoll = now;
+
+		for (File &file : files) {
+			time_t modified = modificationTime(file.path);
+			if (modified != file.modified) {
+				file.modified = modified;
+				report(changed, file.path);
+			}
+		}
+		return changed;
+	}
+
+private:
+	struct File {
+		string path;
+		string name;
+		time_t modified;
+		int watch = -1;
+	};
+
+	vector<File> files;
+	chrono::steady_clock::time_point lastPoll;
+	int fd = -1;
+
+	static time_t modificationTime(const string &path) {
+		struct stat info;
+		return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+	}
+
+	static void report(vector<string> &changed, const string &path) {
+		for (const string &other : changed) {
+			if (other == path) return;
+		}
+		changed.push_back(path);
+	}
+};
+
+#endif
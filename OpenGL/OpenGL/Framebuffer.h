@@ -0,0 +1,244 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <glad/glad.h>
+
+using namespace std;
+
+//Offscreen render target with RGBA8 color and 24-bit depth attachments.
+class Framebuffer {
+public:
+	unsigned int ID = 0;
+	unsigned int colorTexture = 0;
+	unsigned int depthBuffer = 0;
+	int width;
+	int height;
+
+	Framebuffer(int width, int height) {
+		this->width = width;
+		this->height = height;
+
+		//Color attachment
+		glGenTextures(1, &colorTexture);
+		glBindTexture(GL_TEXTURE_2D, colorTexture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glBindTexture(GL_TEXTURE_2D, 0);
+
+		//Depth attachment
+		glGenRenderbuffers(1, &depthBuffer);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+		//Create framebuffer and attach
+		glGenFramebuffers(1, &ID);
+		glBindFramebuffer(GL_FRAMEBUFFER, ID);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTexture, 0);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+
+		//Error
+		if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) log("Framebuffer is not complete");
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+	~Framebuffer() {
+		glDeleteFramebuffers(1, &ID);
+		glDeleteRenderbuffers(1, &depthBuffer);
+		glDeleteTextures(1, &colorTexture);
+	}
+
+	bool isComplete() {
+		glBindFramebuffer(GL_FRAMEBUFFER, ID);
+		bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		return complete;
+	}
+
+	void bind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, ID);
+		glViewport(0, 0, width, height);
+	}
+	void unbind() {
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	}
+
+private:
+	void log(string message) {
+		cout << message << endl;
+	}
+};
+
+//Reads frames back from a framebuffer through a ring of pixel pack buffers.
+//glReadPixels into a PBO returns immediately; the copy is only mapped once its fence
+//has signaled, so the CPU never waits for the frame that was just submitted.
+class FrameReadback {
+public:
+	//Called with tightly packed RGBA rows, bottom row first (GL order).
+	typedef void(*Callback)(int frame, const unsigned char* pixels, int width, int height, void* user);
+
+	FrameReadback(int width, int height, int depth = 3) {
+		this->width = width;
+		this->height = height;
+		slots.resize(depth);
+
+		for (Slot &slot : slots) {
+			glGenBuffers(1, &slot.PBO);
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+			glBufferData(GL_PIXEL_PACK_BUFFER, width * height * 4, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+
+	~FrameReadback() {
+		for (Slot &slot : slots) {
+			if (slot.fence != NULL) glDeleteSync(slot.fence);
+			glDeleteBuffers(1, &slot.PBO);
+		}
+	}
+
+	//Queue a copy of the currently bound read framebuffer.
+	//If every slot is still in flight, the oldest one is completed first.
+	void request(int frame, Callback callback, void* user) {
+		Slot &slot = slots[next];
+		if (slot.fence != NULL) complete(slot, callback, user, true);
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+		glPixelStorei(GL_PACK_ALIGNMENT, 1);
+		glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)0);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot.frame = frame;
+		next = (next + 1) % slots.size();
+	}
+
+	//Deliver every readback whose fence has signaled. Never blocks.
+	void poll(Callback callback, void* user) {
+		for (size_t i = 0;i < slots.size();i++) {
+			Slot &slot = slots[(next + i) % slots.size()];
+			if (slot.fence != NULL) complete(slot, callback, user, false);
+		}
+	}
+
+	//Deliver all outstanding readbacks, waiting on the GPU if needed.
+	void flush(Callback callback, void* user) {
+		for (size_t i = 0;i < slots.size();i++) {
+			Slot &slot = slots[(next + i) % slots.size()];
+			if (slot.fence != NULL) complete(slot, callback, user, true);
+		}
+	}
+
+	//Write tightly packed RGBA pixels (bottom row first) as a binary PPM.
+	static bool writePPM(string path, const unsigned char* pixels, int width, int height) {
+		ofstream out(path, ios::binary);
+		if (!out) return false;
+
+		out << "P6\n" << width << " " << height << "\n255\n";
+		vector<unsigned char> row(width * 3);
+		for (int y = height - 1;y >= 0;y--) {
+			const unsigned char* src = pixels + (size_t)y * width * 4;
+			for (int x = 0;x < width;x++) {
+				row[x * 3 + 0] = src[x * 4 + 0];
+				row[x * 3 + 1] = src[x * 4 + 1];
+				row[x * 3 + 2] = src[x * 4 + 2];
+			}
+			out.write((const char*)row.data(), row.size());
+		}
+		return true;
+	}
+
+private:
+	struct Slot {
+		unsigned int PBO = 0;
+		GLsync fence = NULL;
+		int frame = -1;
+	};
+
+	vector<Slot> slots;
+	size_t next = 0;
+	int width;
+	int height;
+
+	void complete(Slot &slot, Callback callback, void* user, bool wait) {
+		GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+		if (status == GL_TIMEOUT_EXPIRED) return;
+
+		glDeleteSync(slot.fence);
+		slot.fence = NULL;
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.PBO);
+		void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, width * height * 4, GL_MAP_READ_BIT);
+		if (pixels != NULL) {
+			if (callback != NULL) callback(slot.frame, (const unsigned char*)pixels, width, height, user);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+};
+
+//Measures GPU time of each frame with GL_TIME_ELAPSED queries.
+//Results are collected a few frames late so reading them never stalls the pipeline.
+class FrameTimer {
+public:
+	FrameTimer(int depth = 4) {
+		queries.resize(depth);
+		frames.resize(depth, -1);
+		glGenQueries(depth, queries.data());
+	}
+
+	~FrameTimer() {
+		glDeleteQueries((GLsizei)queries.size(), queries.data());
+	}
+
+	void begin(int frame) {
+		//Slot is about to be reused, so its previous result must be collected first
+		if (frames[next] >= 0) collect(next, true);
+		frames[next] = frame;
+		glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+	}
+
+	void end() {
+		glEndQuery(GL_TIME_ELAPSED);
+		next = (next + 1) % queries.size();
+	}
+
+	//Collect available results. When wait is true, outstanding queries are resolved too.
+	void poll(bool wait = false) {
+		for (size_t i = 0;i < queries.size();i++) {
+			size_t slot = (next + i) % queries.size();
+			if (frames[slot] >= 0) collect(slot, wait);
+		}
+	}
+
+	//GPU time in nanoseconds, indexed by frame. Unresolved frames are 0.
+	vector<unsigned long long> results;
+
+private:
+	vector<unsigned int> queries;
+	vector<int> frames;
+	size_t next = 0;
+
+	void collect(size_t slot, bool wait) {
+		GLint available = 0;
+		if (!wait) {
+			glGetQueryObjectiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (!available) return;
+		}
+
+		GLuint64 elapsed = 0;
+		glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &elapsed);
+
+		int frame = frames[slot];
+		if ((int)results.size() <= frame) results.resize(frame + 1, 0);
+		results[frame] = elapsed;
+		frames[slot] = -1;
+	}
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef GL_EXTENSIONS_H
+#define GL_EXTENSIONS_H
+
+#include <string>
+#include <cstring>
+#include <glad/glad.h>
+
+using namespace std;
+
+//glad is generated for core 3.3 only. Newer entry points are loaded here when the
+//driver exposes them, either as an extension or through a newer core version.
+
+#ifndef GL_ARB_get_program_binary
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+typedef void (APIENTRYP PFNGLGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNGLPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNGLPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+#endif
+
+#ifndef GL_ARB_buffer_storage
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#define GL_CLIENT_STORAGE_BIT 0x0200
+typedef void (APIENTRYP PFNGLBUFFERSTORAGEPROC)(GLenum target, GLsizeiptr size, const void *data, GLbitfield flags);
+#endif
+
+#ifndef GL_ARB_copy_image
+typedef void (APIENTRYP PFNGLCOPYIMAGESUBDATAPROC)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ, GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ, GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth);
+#endif
+
+#ifndef GL_KHR_parallel_shader_compile
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+#endif
+
+#ifndef GL_EXT_texture_compression_s3tc
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT3_EXT 0x83F2
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+#ifndef GL_EXT_texture_sRGB
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT 0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT3_EXT 0x8C4E
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
+#endif
+
+#ifndef GL_ARB_texture_compression_bptc
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#define GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM 0x8E8D
+#endif
+
+#ifndef GL_ARB_ES3_compatibility
+#define GL_COMPRESSED_RGB8_ETC2 0x9274
+#define GL_COMPRESSED_SRGB8_ETC2 0x9275
+#define GL_COMPRESSED_RGBA8_ETC2_EAC 0x9278
+#define GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC 0x9279
+#endif
+
+class GLExtensions {
+public:
+	//GL_ARB_get_program_binary
+	bool programBinary = false;
+	PFNGLGETPROGRAMBINARYPROC getProgramBinary = NULL;
+	PFNGLPROGRAMBINARYPROC programBinaryLoad = NULL;
+	PFNGLPROGRAMPARAMETERIPROC programParameteri = NULL;
+
+	//GL_KHR_parallel_shader_compile (or the ARB variant)
+	bool parallelShaderCompile = false;
+	PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxShaderCompilerThreads = NULL;
+
+	//GL_ARB_buffer_storage
+	bool bufferStorage = false;
+	PFNGLBUFFERSTORAGEPROC bufferStorageAllocate = NULL;
+
+	//GL_ARB_copy_image
+	bool copyImage = false;
+	PFNGLCOPYIMAGESUBDATAPROC copyImageSubData = NULL;
+
+	//Compressed texture formats, uploaded with the core glCompressedTexImage2D
+	bool s3tc = false;		//BC1 to BC3, GL_EXT_texture_compression_s3tc
+	bool s3tcSrgb = false;	//Their sRGB variants, GL_EXT_texture_sRGB
+	bool bptc = false;		//BC7, GL_ARB_texture_compression_bptc
+	bool etc2 = false;		//GL_ARB_ES3_compatibility
+	//BC4 and BC5 (RGTC) are core since 3.0
+
+	static GLExtensions& get() {
+		static GLExtensions extensions;
+		return extensions;
+	}
+
+	//Call once after gladLoadGLLoader with the same loader
+	void load(GLADloadproc loader) {
+		glGetIntegerv(GL_MAJOR_VERSION, &major);
+		glGetIntegerv(GL_MINOR_VERSION, &minor);
+
+		if (version(4, 1) || supported("GL_ARB_get_program_binary")) {
+			getProgramBinary = (PFNGLGETPROGRAMBINARYPROC)loader("glGetProgramBinary");
+			programBinaryLoad = (PFNGLPROGRAMBINARYPROC)loader("glProgramBinary");
+			programParameteri = (PFNGLPROGRAMPARAMETERIPROC)loader("glProgramParameteri");
+
+			GLint formats = 0;
+			glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+			programBinary = getProgramBinary != NULL && programBinaryLoad != NULL && programParameteri != NULL && formats > 0;
+		}
+
+		if (supported("GL_KHR_parallel_shader_compile")) {
+			maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsKHR");
+			parallelShaderCompile = true;
+		}
+		else if (supported("GL_ARB_parallel_shader_compile")) {
+			maxShaderCompilerThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)loader("glMaxShaderCompilerThreadsARB");
+			parallelShaderCompile = true;
+		}
+
+		if (version(4, 4) || supported("GL_ARB_buffer_storage")) {
+			bufferStorageAllocate = (PFNGLBUFFERSTORAGEPROC)loader("glBufferStorage");
+			bufferStorage = bufferStorageAllocate != NULL;
+		}
+
+		if (version(4, 3) || supported("GL_ARB_copy_image")) {
+			copyImageSubData = (PFNGLCOPYIMAGESUBDATAPROC)loader("glCopyImageSubData");
+			copyImage = copyImageSubData != NULL;
+		}
+
+		s3tc = supported("GL_EXT_texture_compression_s3tc");
+		s3tcSrgb = s3tc && (supported("GL_EXT_texture_sRGB") || supported("GL_EXT_texture_compression_s3tc_srgb"));
+		bptc = version(4, 2) || supported("GL_ARB_texture_compression_bptc");
+		etc2 = version(4, 3) || supported("GL_ARB_ES3_compatibility");
+	}
+
+	bool version(int major, int minor) {
+		return this->major > major || (this->major == major && this->minor >= minor);
+	}
+
+	bool supported(const char* name) {
+		GLint count = 0;
+		glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+		for (int i = 0;i < count;i++) {
+			const char* extension = (const char*)glGetStringi(GL_EXTENSIONS, i);
+			if (extension != NULL && strcmp(extension, name) == 0) return true;
+		}
+		return false;
+	}
+
+private:
+	GLint major = 0;
+	GLint minor = 0;
+
+	GLExtensions() {
+	}
+};
+
+#endif
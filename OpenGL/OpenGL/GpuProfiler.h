@@ -0,0 +1,189 @@
+#ifndef GPU_PROFILER_H
+#define GPU_PROFILER_H
+
+#include <vector>
+#include <glad/glad.h>
+#include "Profiler.h"
+
+using namespace std;
+
+//GPU side zones measured with GL_TIMESTAMP queries.
+//Each frame records into its own query pool and a pool is only read back LATENCY frames
+//later, once the GPU has finished it, so collecting results never waits on the driver.
+//Timestamps are shifted onto the CPU profiler clock and show up as the "GPU" track.
+class GpuProfiler {
+public:
+	static const int LATENCY = 3;				//Frames in flight before a pool is reused
+	static const int MAX_ZONES = 256;			//Zones recorded per frame
+	static const int CALIBRATE_INTERVAL = 600;	//Frames between clock calibrations
+
+	static GpuProfiler& instance() {
+		static GpuProfiler profiler;
+		return profiler;
+	}
+
+	//Needs a current GL context. Zones recorded before this are ignored.
+	void initialize() {
+		if (track == NULL) track = Profiler::instance().createTrack("GPU");
+		calibrate();
+		initialized = true;
+	}
+
+	bool isInitialized() {
+		return initialized;
+	}
+
+	//Delete every query while the context is still current. The profiler is a static, so
+	//its destructor runs after the context is gone and cannot do this. Zones recorded
+	//afterwards are ignored until initialize() is called again.
+	void shutdown() {
+		for (Pool &pool : pools) pool.release();
+		openZones.clear();
+		initialized = false;
+	}
+
+	void beginZone(const ProfileSite* site) {
+		if (!initialized) return;
+
+		Pool &pool = pools[frame % LATENCY];
+		if ((int)pool.zones.size() >= MAX_ZONES) {
+			openZones.push_back(-1);
+			dropped++;
+			return;
+		}
+
+		Zone zone;
+		zone.site = site;
+		zone.depth = (int)openZones.size();
+		zone.begin = pool.query(pool.used++);
+		zone.end = pool.query(pool.used++);
+		glQueryCounter(zone.begin, GL_TIMESTAMP);
+		pool.last = zone.begin;
+
+		openZones.push_back((int)pool.zones.size());
+		pool.zones.push_back(zone);
+	}
+
+	void endZone() {
+		if (!initialized || openZones.empty()) return;
+
+		int index = openZones.back();
+		openZones.pop_back();
+		if (index < 0) return;
+
+		Pool &pool = pools[frame % LATENCY];
+		glQueryCounter(pool.zones[index].end, GL_TIMESTAMP);
+		pool.last = pool.zones[index].end;
+	}
+
+	//Close the current frame and hand the oldest finished frame to the CPU profiler.
+	//Call once per frame, before Profiler::endFrame. Results arrive LATENCY - 1 frames late.
+	void endFrame() {
+		if (!initialized) return;
+
+		frame++;
+		if (frame % CALIBRATE_INTERVAL == 0) calibrate();
+
+		//The pool about to be reused was recorded LATENCY frames ago
+		Pool &pool = pools[frame % LATENCY];
+		if (!pool.zones.empty()) {
+			GLint available = 0;
+			glGetQueryObjectiv(pool.last, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) resolve(pool);
+			else dropped += pool.zones.size();
+		}
+		pool.zones.clear();
+		pool.used = 0;
+	}
+
+	//Zones whose results were discarded because the GPU was too far behind
+	unsigned long long droppedZones() {
+		return dropped;
+	}
+
+	//Nanoseconds to add to a GL timestamp to get Profiler::now() time
+	long long clockOffset() {
+		return offset;
+	}
+
+private:
+	struct Zone {
+		const ProfileSite* site;
+		int depth;
+		unsigned int begin;
+		unsigned int end;
+	};
+
+	struct Pool {
+		vector<unsigned int> queries;
+		vector<Zone> zones;
+		int used = 0;
+		unsigned int last = 0;	//Most recently issued query; results arrive in order
+
+		unsigned int query(int index) {
+			if (index >= (int)queries.size()) {
+				size_t first = queries.size();
+				queries.resize(first + 32);
+				glGenQueries(32, &queries[first]);
+			}
+			return queries[index];
+		}
+
+		void release() {
+			if (!queries.empty()) glDeleteQueries((GLsizei)queries.size(), queries.data());
+			queries.clear();
+			zones.clear();
+			used = 0;
+			last = 0;
+		}
+	};
+
+	Pool pools[LATENCY];
+	vector<int> openZones;
+	ProfileBuffer* track = NULL;
+	long long frame = 0;
+	long long offset = 0;
+	unsigned long long dropped = 0;
+	bool initialized = false;
+
+	GpuProfiler() {
+	}
+
+	//GL_TIMESTAMP read with glGetInteger64v is the GPU clock when the call reaches it,
+	//which lets GPU and CPU times be compared without waiting for any queued work.
+	void calibrate() {
+		GLint64 gpuNow = 0;
+		long long cpuBefore = Profiler::now();
+		glGetInteger64v(GL_TIMESTAMP, &gpuNow);
+		long long cpuAfter = Profiler::now();
+		offset = (cpuBefore + cpuAfter) / 2 - gpuNow;
+	}
+
+	void resolve(Pool &pool) {
+		for (Zone &zone : pool.zones) {
+			GLuint64 begin = 0, end = 0;
+			glGetQueryObjectui64v(zone.begin, GL_QUERY_RESULT, &begin);
+			glGetQueryObjectui64v(zone.end, GL_QUERY_RESULT, &end);
+			track->push(ProfileEvent{ zone.site, (long long)begin + offset, (long long)end + offset, zone.depth });
+		}
+	}
+};
+
+//Times the GL commands issued in the enclosing scope on the GPU
+class GpuProfileZone {
+public:
+	GpuProfileZone(const ProfileSite* site) {
+		GpuProfiler::instance().beginZone(site);
+	}
+
+	~GpuProfileZone() {
+		GpuProfiler::instance().endZone();
+	}
+};
+
+//Usage: GPU_ZONE("name"); at the top of a scope issuing GL commands. Reported as "gpu name".
+#define GPU_ZONE(name) \
+	static const ProfileSite PROFILE_CONCAT(gpuProfileSite, __LINE__)("gpu " name, __FILE__, __LINE__); \
+	GpuProfileZone PROFILE_CONCAT(gpuProfileZone, __LINE__)(&PROFILE_CONCAT(gpuProfileSite, __LINE__))
+
+#endif
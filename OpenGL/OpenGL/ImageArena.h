@@ -0,0 +1,173 @@
+#ifndef IMAGE_ARENA_H
+#define IMAGE_ARENA_H
+
+#include <cstdlib>
+#include <cstring>
+#include <cstddef>
+
+using namespace std;
+
+//Recycles the memory stb_image decodes with, see stb_image.cpp.
+//Every decode allocates the same kinds of buffers: huffman and zlib tables, component
+//planes and row buffers. Loading thousands of textures turns that into heavy malloc
+//traffic, so freed blocks are kept in a cache per thread, sorted into power of two size
+//classes, and handed out again by the next decode on that thread.
+//Blocks may be freed on any thread and join that thread's cache. A thread caches at most
+//its capacity and gives the rest back to the heap.
+//Output images leave the arena through detach() before stb_image returns them: they live
+//on after the decode, often end up freed on the render thread, and would waste up to half
+//their size to the rounding.
+class ImageArena {
+public:
+	static const size_t DEFAULT_CAPACITY = 64 * 1024 * 1024;
+
+	struct Stats {
+		size_t allocations = 0;
+		size_t reused = 0;	//Allocations served from the cache
+		size_t cached = 0;	//Bytes held by the cache
+	};
+
+	static void* allocate(size_t size) {
+		int sizeClass = classOf(size);
+		if (sizeClass < 0) return NULL;
+
+		Cache &cache = get();
+		cache.stats.allocations++;
+		Block* block = cache.blocks[sizeClass];
+		if (block != NULL) {
+			cache.blocks[sizeClass] = block->next;
+			cache.stats.cached -= classSize(sizeClass);
+			cache.stats.reused++;
+		}
+		else {
+			block = (Block*)malloc(HEADER + classSize(sizeClass));
+			if (block == NULL) return NULL;
+			block->sizeClass = sizeClass;
+		}
+		return (char*)block + HEADER;
+	}
+
+	static void* reallocate(void* data, size_t size) {
+		if (data == NULL) return allocate(size);
+		if (blockOf(data)->sizeClass == DETACHED) return resize(blockOf(data), size);
+		size_t capacity = classSize(blockOf(data)->sizeClass);
+		if (size <= capacity) return data;
+
+		void* grown = allocate(size);
+		if (grown == NULL) return NULL;
+		memcpy(grown, data, capacity);
+		release(data);
+		return grown;
+	}
+
+	static void release(void* data) {
+		if (data == NULL) return;
+		Block* block = blockOf(data);
+		if (block->sizeClass == DETACHED) {
+			free(block);
+			return;
+		}
+		size_t size = classSize(block->sizeClass);
+
+		Cache &cache = get();
+		if (cache.stats.cached + size > cache.capacity) {
+			free(block);
+			return;
+		}
+		block->next = cache.blocks[block->sizeClass];
+		cache.blocks[block->sizeClass] = block;
+		cache.stats.cached += size;
+	}
+
+	//Shrink a block to size bytes and take it out of the arena for good, release() gives
+	//it straight back to the heap. Returns the block, which may have moved.
+	static void* detach(void* data, size_t size) {
+		if (data == NULL) return NULL;
+		Block* block = blockOf(data);
+		if (block->sizeClass == DETACHED) return data;
+		void* shrunk = resize(block, size);
+		if (shrunk != NULL) return shrunk;
+		block->sizeClass = DETACHED;
+		return data;
+	}
+
+	//Cache limit of the calling thread, 0 turns its cache off
+	static void setCapacity(size_t capacity) {
+		Cache &cache = get();
+		cache.capacity = capacity;
+		if (cache.stats.cached > capacity) cache.trim();
+	}
+
+	//Give the calling thread's cache back to the heap
+	static void trim() {
+		get().trim();
+	}
+
+	//Counters of the calling thread
+	static Stats stats() {
+		return get().stats;
+	}
+
+private:
+	static const int MIN_CLASS = 6;		//64 bytes
+	static const int CLASSES = 32;		//Up to 2 GB, more than stb_image ever asks for
+	static const size_t HEADER = 16;	//Keeps the malloc alignment
+	static const size_t DETACHED = (size_t)-1;	//Size class of blocks outside the arena
+
+	struct Block {
+		size_t sizeClass;
+		Block* next;	//While cached
+	};
+
+	struct Cache {
+		Block* blocks[CLASSES] = {};
+		size_t capacity = DEFAULT_CAPACITY;
+		Stats stats;
+
+		~Cache() {
+			trim();
+		}
+
+		void trim() {
+			for (int i = 0;i < CLASSES;i++) {
+				while (blocks[i] != NULL) {
+					Block* block = blocks[i];
+					blocks[i] = block->next;
+					free(block);
+				}
+			}
+			stats.cached = 0;
+		}
+	};
+
+	static Cache& get() {
+		static thread_local Cache cache;
+		return cache;
+	}
+
+	static size_t classSize(size_t sizeClass) {
+		return (size_t)1 << sizeClass;
+	}
+
+	static int classOf(size_t size) {
+		for (int i = MIN_CLASS;i < CLASSES;i++) {
+			if (size <= classSize(i)) return i;
+		}
+		return -1;
+	}
+
+	//realloc a block to exactly size bytes, outside the arena. NULL if that fails, the
+	//block is then unchanged.
+	static void* resize(Block* block, size_t size) {
+		Block* resized = (Block*)realloc(block, HEADER + size);
+		if (resized == NULL) return NULL;
+		resized->sizeClass = DETACHED;
+		return (char*)resized + HEADER;
+	}
+
+	static Block* blockOf(void* data) {
+		return (Block*)((char*)data - HEADER);
+	}
+};
+
+#endif
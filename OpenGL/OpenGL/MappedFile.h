@@ -0,0 +1,95 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <string>
+#include <cstddef>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+//Read-only memory mapping of a whole file.
+//Pages are read in by the OS as they are touched, so nothing is copied into a buffer of
+//our own and untouched parts of the file cost nothing.
+class MappedFile {
+public:
+	MappedFile() {
+	}
+
+	MappedFile(string path) {
+		open(path);
+	}
+
+	~MappedFile() {
+		close();
+	}
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool open(string path) {
+		close();
+#ifdef _WIN32
+		HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+		if (file == INVALID_HANDLE_VALUE) return false;
+		LARGE_INTEGER length;
+		if (GetFileSizeEx(file, &length) && length.QuadPart > 0) {
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+			if (mapping != NULL) {
+				data = (const unsigned char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+				CloseHandle(mapping);
+			}
+			if (data != NULL) size = (size_t)length.QuadPart;
+		}
+		CloseHandle(file);
+#else
+		int file = ::open(path.c_str(), O_RDONLY);
+		if (file < 0) return false;
+		struct stat status;
+		if (fstat(file, &status) == 0 && status.st_size > 0) {
+			void* view = mmap(NULL, (size_t)status.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+			if (view != MAP_FAILED) {
+				data = (const unsigned char*)view;
+				size = (size_t)status.st_size;
+			}
+		}
+		::close(file);
+#endif
+		return data != NULL;
+	}
+
+	void close() {
+		if (data == NULL) return;
+#ifdef _WIN32
+		UnmapViewOfFile(data);
+#else
+		munmap((void*)data, size);
+#endif
+		data = NULL;
+		size = 0;
+	}
+
+	bool isOpen() const {
+		return data != NULL;
+	}
+
+	//Touch every page so it is read in now, on this thread, instead of on first use
+	void prefetch() const {
+		volatile unsigned char sink = 0;
+		for (size_t i = 0;i < size;i += PAGE) sink += data[i];
+	}
+
+	const unsigned char* data = NULL;
+	size_t size = 0;
+
+private:
+	static const size_t PAGE = 4096;
+};
+
+#endif
@@ -0,0 +1,345 @@
+#ifndef MIP_BUILDER_H
+#define MIP_BUILDER_H
+
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include "ThreadPool.h"
+#include "TextureFile.h"
+#include "stb_image.h"
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MIP_BUILDER_SSE2
+#include <emmintrin.h>
+#if (defined(_MSC_VER) && _MSC_VER >= 1700) || (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__)))
+#define MIP_BUILDER_AVX
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#define MIP_BUILDER_AVX_TARGET
+#else
+#define MIP_BUILDER_AVX_TARGET __attribute__((target("avx2")))
+#endif
+#endif
+#endif
+
+using namespace std;
+
+//Builds mip chains of RGBA8 images on the CPU, in place of glGenerateMipmap.
+//
+//Levels are filtered in linear light: sRGB color is decoded before filtering and encoded
+//again afterwards, so dark and bright texels mix the way the eye expects. Each level is
+//filtered from the previous one at float precision with a separable kernel, a box or a
+//Kaiser windowed sinc, which keeps detail that the box filter blurs away. Alpha tested
+//textures can keep the fraction of texels passing the test, so foliage does not thin out
+//in the distance.
+//
+//The filters run one RGBA pixel per SSE2 register and, when stb_image reports AVX2, two
+//pixels at a time down the columns. Every path does the same float operations in the same
+//order, so their output is identical. Bands of rows are split across a ThreadPool, and
+//buildAll() spreads many images over one.
+class MipBuilder {
+public:
+	enum Filter {
+		BOX,
+		KAISER
+	};
+
+	struct Settings {
+		Filter filter = KAISER;
+		bool srgb = false;		//Color is sRGB encoded
+		float alphaCutoff = 0;	//Alpha test threshold in 0 to 1 whose coverage every level keeps, 0 for none
+	};
+
+	struct Image {
+		const unsigned char* rgba;
+		int width;
+		int height;
+		vector<vector<unsigned char>> levels;	//Output
+	};
+
+	//levels[i] receives level i down to 1x1, starting with a copy of the image
+	static void build(const unsigned char* rgba, int width, int height, const Settings &settings, vector<vector<unsigned char>> &levels, ThreadPool* pool = NULL) {
+		int count = TextureFile::levelCount(width, height);
+		levels.resize(count);
+		levels[0].assign(rgba, rgba + (size_t)width * height * 4);
+		if (count == 1) return;
+
+		const Tables &table = tables();
+		int simd = stbi_get_simd_level();
+		float coverage = settings.alphaCutoff > 0 ? alphaCoverage(rgba, width, height, settings.alphaCutoff) : 0;
+		vector<float> previous, current;
+		for (int level = 1;level < count;level++) {
+			int sourceWidth = TextureFile::mipSize(width, level - 1), sourceHeight = TextureFile::mipSize(height, level - 1);
+			int levelWidth = TextureFile::mipSize(width, level), levelHeight = TextureFile::mipSize(height, level);
+			Kernel horizontal = kernel(settings.filter, sourceWidth, levelWidth);
+			Kernel vertical = kernel(settings.filter, sourceHeight, levelHeight);
+			current.resize((size_t)levelWidth * levelHeight * 4);
+
+			int bands = (levelHeight + BAND - 1) / BAND;
+			function<void(int)> filterBand = [&](int band) {
+				int first = band * BAND;
+				int last = first + BAND < levelHeight ? first + BAND : levelHeight;
+				//Source rows the band reads, filtered horizontally once each
+				int low = sourceHeight, high = 0;
+				for (int y = first;y < last;y++) {
+					for (int t = 0;t < vertical.taps;t++) {
+						int row = vertical.indices[y * vertical.taps + t];
+						if (row < low) low = row;
+						if (row > high) high = row;
+					}
+				}
+				vector<float> rows((size_t)(high - low + 1) * levelWidth * 4);
+				vector<float> decoded(level == 1 ? (size_t)sourceWidth * 4 : 0);
+				for (int row = low;row <= high;row++) {
+					const float* source;
+					if (level == 1) {
+						decode(rgba + (size_t)row * sourceWidth * 4, sourceWidth, settings.srgb ? table.srgbToLinear : table.unormToLinear, decoded.data());
+						source = decoded.data();
+					}
+					else source = previous.data() + (size_t)row * sourceWidth * 4;
+					filterRow(source, horizontal, levelWidth, simd, rows.data() + (size_t)(row - low) * levelWidth * 4);
+				}
+				for (int y = first;y < last;y++) filterColumns(rows.data(), low, levelWidth, vertical, y, simd, current.data() + (size_t)y * levelWidth * 4);
+			};
+			run(bands, filterBand, pool);
+
+			float scale = settings.alphaCutoff > 0 ? alphaScale(current, settings.alphaCutoff, coverage) : 1;
+			levels[level].resize((size_t)levelWidth * levelHeight * 4);
+			function<void(int)> encodeBand = [&](int band) {
+				int first = band * BAND;
+				int last = first + BAND < levelHeight ? first + BAND : levelHeight;
+				size_t offset = (size_t)first * levelWidth * 4;
+				encode(current.data() + offset, (size_t)(last - first) * levelWidth, settings.srgb, scale, levels[level].data() + offset);
+			};
+			run(bands, encodeBand, pool);
+			previous.swap(current);
+		}
+	}
+
+	//Build every image's chain, one image per task of pool
+	static void buildAll(vector<Image> &images, const Settings &settings, ThreadPool &pool) {
+		pool.parallelFor((int)images.size(), [&images, &settings](int i) {
+			build(images[i].rgba, images[i].width, images[i].height, settings, images[i].levels);
+		});
+	}
+
+	static const char* filterName(Filter filter) {
+		return filter == BOX ? "box" : "kaiser";
+	}
+
+	//Returns false for an unknown name
+	static bool parseFilter(string name, Filter &filter) {
+		if (name == "box") filter = BOX;
+		else if (name == "kaiser") filter = KAISER;
+		else return false;
+		return true;
+	}
+
+private:
+	static const int BAND = 16;					//Output rows per task
+	static const int GUESSES = 4096;
+	static constexpr float KAISER_RADIUS = 3;	//In destination texels
+	static constexpr float KAISER_BETA = 4;
+
+	//Source texels and weights of every destination texel along one axis
+	struct Kernel {
+		int taps;
+		vector<int> indices;	//Clamped to the edge
+		vector<float> weights;
+	};
+
+	struct Tables {
+		float srgbToLinear[256];
+		float unormToLinear[256];
+		float srgbThresholds[255];	//Linear values halfway between neighboring sRGB bytes
+		unsigned char srgbGuesses[GUESSES];	//sRGB byte of a linear value, within one
+	};
+
+	static const Tables& tables() {
+		static const Tables table = [] {
+			Tables built;
+			for (int i = 0;i < 256;i++) {
+				float value = i / 255.0f;
+				built.srgbToLinear[i] = value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+				built.unormToLinear[i] = value;
+			}
+			for (int i = 0;i < 255;i++) built.srgbThresholds[i] = (built.srgbToLinear[i] + built.srgbToLinear[i + 1]) / 2;
+			int byte = 0;
+			for (int i = 0;i < GUESSES;i++) {
+				while (byte < 255 && (float)i / (GUESSES - 1) > built.srgbThresholds[byte]) byte++;
+				built.srgbGuesses[i] = (unsigned char)byte;
+			}
+			return built;
+		}();
+		return table;
+	}
+
+	static void run(int count, function<void(int)> &task, ThreadPool* pool) {
+		if (pool != NULL) pool->parallelFor(count, task);
+		else for (int i = 0;i < count;i++) task(i);
+	}
+
+	static float bessel0(float x) {
+		float sum = 1, term = 1;
+		for (int k = 1;k < 20;k++) {
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	static float kaiser(float x) {
+		if (fabsf(x) >= KAISER_RADIUS) return 0;
+		float ratio = x / KAISER_RADIUS;
+		float sinc = fabsf(x) < 1e-6f ? 1 : sinf(3.14159265f * x) / (3.14159265f * x);
+		return sinc * bessel0(KAISER_BETA * sqrtf(1 - ratio * ratio)) / bessel0(KAISER_BETA);
+	}
+
+	static Kernel kernel(Filter filter, int size, int outSize) {
+		float scale = (float)size / outSize;
+		float radius = filter == BOX ? scale / 2 : KAISER_RADIUS * scale;
+		Kernel kernel;
+		kernel.taps = (int)ceilf(radius * 2) + 1;
+		kernel.indices.resize((size_t)outSize * kernel.taps);
+		kernel.weights.resize((size_t)outSize * kernel.taps);
+		for (int x = 0;x < outSize;x++) {
+			float center = (x + 0.5f) * scale;
+			int first = (int)floorf(center - radius);
+			float sum = 0;
+			for (int t = 0;t < kernel.taps;t++) {
+				int i = first + t;
+				float weight;
+				if (filter == BOX) {
+					float left = fmaxf((float)i, center - radius), right = fminf((float)i + 1, center + radius);
+					weight = right > left ? right - left : 0;
+				}
+				else weight = kaiser((i + 0.5f - center) / scale);
+				kernel.indices[x * kernel.taps + t] = i < 0 ? 0 : i >= size ? size - 1 : i;
+				kernel.weights[x * kernel.taps + t] = weight;
+				sum += weight;
+			}
+			for (int t = 0;t < kernel.taps;t++) kernel.weights[x * kernel.taps + t] /= sum;
+		}
+		return kernel;
+	}
+
+	static void decode(const unsigned char* pixels, int count, const float* colorTable, float* out) {
+		const float* alphaTable = tables().unormToLinear;
+		for (int i = 0;i < count;i++) {
+			out[i * 4 + 0] = colorTable[pixels[i * 4 + 0]];
+			out[i * 4 + 1] = colorTable[pixels[i * 4 + 1]];
+			out[i * 4 + 2] = colorTable[pixels[i * 4 + 2]];
+			out[i * 4 + 3] = alphaTable[pixels[i * 4 + 3]];
+		}
+	}
+
+	static unsigned char toUnorm(float value) {
+		return value <= 0 ? 0 : value >= 1 ? 255 : (unsigned char)(value * 255 + 0.5f);
+	}
+
+	//Closest sRGB byte in linear light
+	static unsigned char toSrgb(float value, const Tables &table) {
+		if (value <= 0) return 0;
+		if (value >= 1) return 255;
+		int byte = table.srgbGuesses[(int)(value * (GUESSES - 1))];
+		while (byte < 255 && value > table.srgbThresholds[byte]) byte++;
+		while (byte > 0 && value <= table.srgbThresholds[byte - 1]) byte--;
+		return (unsigned char)byte;
+	}
+
+	static void encode(const float* pixels, size_t count, bool srgb, float alphaScale, unsigned char* out) {
+		const Tables &table = tables();
+		for (size_t i = 0;i < count;i++) {
+			for (int c = 0;c < 3;c++) out[i * 4 + c] = srgb ? toSrgb(pixels[i * 4 + c], table) : toUnorm(pixels[i * 4 + c]);
+			out[i * 4 + 3] = toUnorm(pixels[i * 4 + 3] * alphaScale);
+		}
+	}
+
+	//One row, horizontally
+	static void filterRow(const float* source, const Kernel &kernel, int outSize, int simd, float* out) {
+#ifdef MIP_BUILDER_SSE2
+		if (simd >= STBI_simd_sse2) {
+			for (int x = 0;x < outSize;x++) {
+				const int* indices = &kernel.indices[x * kernel.taps];
+				const float* weights = &kernel.weights[x * kernel.taps];
+				__m128 sum = _mm_setzero_ps();
+				for (int t = 0;t < kernel.taps;t++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(source + indices[t] * 4)));
+				_mm_storeu_ps(out + x * 4, sum);
+			}
+			return;
+		}
+#endif
+		for (int x = 0;x < outSize;x++) {
+			const int* indices = &kernel.indices[x * kernel.taps];
+			const float* weights = &kernel.weights[x * kernel.taps];
+			float sum[4] = {};
+			for (int t = 0;t < kernel.taps;t++) {
+				for (int c = 0;c < 4;c++) sum[c] += weights[t] * source[indices[t] * 4 + c];
+			}
+			memcpy(out + x * 4, sum, sizeof(sum));
+		}
+	}
+
+	//Output row y from horizontally filtered rows, the first of which is source row low
+	static void filterColumns(const float* rows, int low, int width, const Kernel &kernel, int y, int simd, float* out) {
+		const int* indices = &kernel.indices[y * kernel.taps];
+		const float* weights = &kernel.weights[y * kernel.taps];
+		size_t stride = (size_t)width * 4;
+		int i = 0;
+#ifdef MIP_BUILDER_AVX
+		if (simd >= STBI_simd_avx2) i = filterColumnsAvx(rows, low, (int)stride, indices, weights, kernel.taps, out);
+#endif
+#ifdef MIP_BUILDER_SSE2
+		if (simd >= STBI_simd_sse2) {
+			for (;i < (int)stride;i += 4) {
+				__m128 sum = _mm_setzero_ps();
+				for (int t = 0;t < kernel.taps;t++) sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows + (indices[t] - low) * stride + i)));
+				_mm_storeu_ps(out + i, sum);
+			}
+		}
+#endif
+		for (;i < (int)stride;i++) {
+			float sum = 0;
+			for (int t = 0;t < kernel.taps;t++) sum += weights[t] * rows[(indices[t] - low) * stride + i];
+			out[i] = sum;
+		}
+	}
+
+#ifdef MIP_BUILDER_AVX
+	//Returns how many floats it filtered
+	MIP_BUILDER_AVX_TARGET static int filterColumnsAvx(const float* rows, int low, int stride, const int* indices, const float* weights, int taps, float* out) {
+		int i = 0;
+		for (;i + 8 <= stride;i += 8) {
+			__m256 sum = _mm256_setzero_ps();
+			for (int t = 0;t < taps;t++) sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(rows + (size_t)(indices[t] - low) * stride + i)));
+			_mm256_storeu_ps(out + i, sum);
+		}
+		return i;
+	}
+#endif
+
+	static float alphaCoverage(const unsigned char* rgba, int width, int height, float cutoff) {
+		size_t count = (size_t)width * height, passing = 0;
+		for (size_t i = 0;i < count;i++) {
+			if (rgba[i * 4 + 3] / 255.0f > cutoff) passing++;
+		}
+		return (float)passing / count;
+	}
+
+	//Scale for the alpha of a level that brings its coverage closest to coverage
+	static float alphaScale(const vector<float> &pixels, float cutoff, float coverage) {
+		size_t count = pixels.size() / 4;
+		float low = 0, high = 4, scale = 1;
+		for (int iteration = 0;iteration < 12;iteration++) {
+			scale = (low + high) / 2;
+			size_t passing = 0;
+			for (size_t i = 0;i < count;i++) {
+				if (pixels[i * 4 + 3] * scale > cutoff) passing++;
+			}
+			if ((float)passing / count < coverage) low = scale;
+			else high = scale;
+		}
+		return scale;
+	}
+};
+
+#endif
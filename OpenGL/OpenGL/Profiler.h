@@ -0,0 +1,335 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+
+using namespace std;
+
+//Static description of a profiled zone. There is one per PROFILE_ZONE call site,
+//so recording a zone only stores a pointer and never copies the name.
+struct ProfileSite {
+	const char* name;
+	const char* file;
+	int line;
+	int zone;	//Interned zone index; call sites with the same name share it
+
+	ProfileSite(const char* name, const char* file, int line);
+};
+
+struct ProfileEvent {
+	const ProfileSite* site;
+	long long begin;	//Nanoseconds since profiler start
+	long long end;
+	int depth;			//Nesting depth on the recording thread
+};
+
+//Fixed size single producer, single consumer ring of events.
+//The owning thread pushes, Profiler::endFrame drains; neither side locks.
+class ProfileBuffer {
+public:
+	static const unsigned int CAPACITY = 1 << 14;
+
+	string threadName;
+	int threadIndex;
+	atomic<unsigned long long> dropped;
+
+	ProfileBuffer(string threadName, int threadIndex) : dropped(0) {
+		this->threadName = threadName;
+		this->threadIndex = threadIndex;
+		head.store(0);
+		tail.store(0);
+	}
+
+	void push(const ProfileEvent &event) {
+		unsigned int h = head.load(memory_order_relaxed);
+		if (h - tail.load(memory_order_acquire) >= CAPACITY) {
+			dropped.fetch_add(1, memory_order_relaxed);
+			return;
+		}
+		events[h & (CAPACITY - 1)] = event;
+		head.store(h + 1, memory_order_release);
+	}
+
+	template<typename F>
+	void drain(F &&consume) {
+		unsigned int t = tail.load(memory_order_relaxed);
+		unsigned int h = head.load(memory_order_acquire);
+		for (;t != h;t++) consume(events[t & (CAPACITY - 1)]);
+		tail.store(t, memory_order_release);
+	}
+
+private:
+	ProfileEvent events[CAPACITY];
+	atomic<unsigned int> head;
+	atomic<unsigned int> tail;
+};
+
+//Aggregated timing of one zone name over the last frames
+struct ZoneStats {
+	string name;
+	int depth = 0;
+	long long min = 0;
+	long long avg = 0;
+	long long p99 = 0;
+	long long last = 0;
+	int calls = 0;		//Calls in the last frame
+};
+
+class Profiler {
+public:
+	static const int HISTORY = 240;		//Frames kept for min/avg/p99
+	static const int FRAME_TRACK = -1;	//Trace track holding one event per frame
+
+	static Profiler& instance() {
+		static Profiler profiler;
+		return profiler;
+	}
+
+	static long long now() {
+		return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - instance().epoch).count();
+	}
+
+	//Return the calling thread's buffer, creating it on first use.
+	static ProfileBuffer* threadBuffer() {
+		static thread_local ProfileBuffer* buffer = NULL;
+		if (buffer == NULL) buffer = instance().createTrack("");
+		return buffer;
+	}
+
+	static int& threadDepth() {
+		static thread_local int depth = 0;
+		return depth;
+	}
+
+	//Name the calling thread in reports and traces
+	void setThreadName(string name) {
+		ProfileBuffer* buffer = threadBuffer();
+		lock_guard<mutex> lock(registryMutex);
+		buffer->threadName = name;
+	}
+
+	//Create an event buffer shown as its own track. Used for each thread and for
+	//sources that are not threads, like the GPU. Only one thread may push to it.
+	ProfileBuffer* createTrack(string name) {
+		lock_guard<mutex> lock(registryMutex);
+		buffers.push_back(unique_ptr<ProfileBuffer>(new ProfileBuffer(name, (int)buffers.size())));
+		return buffers.back().get();
+	}
+
+	int intern(const char* name) {
+		lock_guard<mutex> lock(registryMutex);
+		map<string, int>::iterator found = zoneIndex.find(name);
+		if (found != zoneIndex.end()) return found->second;
+
+		int zone = (int)zones.size();
+		zoneIndex[name] = zone;
+		zones.push_back(Zone());
+		zones.back().name = name;
+		return zone;
+	}
+
+	//Drain every thread's buffer and fold the events into per-frame statistics.
+	//Call once per frame from a single thread.
+	void endFrame() {
+		lock_guard<mutex> lock(registryMutex);
+		long long frameEnd = now();
+
+		for (Zone &zone : zones) {
+			zone.frameTotal = 0;
+			zone.frameCalls = 0;
+		}
+
+		for (unique_ptr<ProfileBuffer> &buffer : buffers) {
+			int threadIndex = buffer->threadIndex;
+			buffer->drain([&](const ProfileEvent &event) {
+				Zone &zone = zones[event.site->zone];
+				zone.frameTotal += event.end - event.begin;
+				zone.frameCalls++;
+				if (zone.frameCalls == 1) zone.depth = event.depth;
+				if (capturing) trace.push_back(TraceEvent{ event, threadIndex });
+			});
+		}
+
+		for (Zone &zone : zones) {
+			if (zone.history.empty()) {
+				zone.history.resize(HISTORY, 0);
+				zone.firstFrame = frameCount;
+			}
+			zone.history[frameCount % HISTORY] = zone.frameTotal;
+			zone.lastCalls = zone.frameCalls;
+		}
+
+		if (capturing) trace.push_back(TraceEvent{ ProfileEvent{ NULL, frameStart, frameEnd, 0 }, FRAME_TRACK });
+		frameStart = frameEnd;
+		frameCount++;
+	}
+
+	vector<ZoneStats> stats() {
+		lock_guard<mutex> lock(registryMutex);
+		vector<ZoneStats> result;
+
+		vector<long long> samples;
+		for (Zone &zone : zones) {
+			if (zone.history.empty()) continue;
+
+			//Only the frames since the zone was first seen, it had no samples before
+			int frames = (int)min<long long>(frameCount - zone.firstFrame, HISTORY);
+			samples.clear();
+			for (long long frame = frameCount - frames;frame < frameCount;frame++) samples.push_back(zone.history[frame % HISTORY]);
+			sort(samples.begin(), samples.end());
+
+			long long total = 0;
+			for (long long sample : samples) total += sample;
+
+			ZoneStats stat;
+			stat.name = zone.name;
+			stat.depth = zone.depth;
+			stat.min = samples.front();
+			stat.avg = total / frames;
+			stat.p99 = samples[(frames - 1) * 99 / 100];
+			stat.last = zone.history[(frameCount - 1) % HISTORY];
+			stat.calls = zone.lastCalls;
+			result.push_back(stat);
+		}
+		return result;
+	}
+
+	//Print per-zone frame time over the last HISTORY frames, indented by nesting depth
+	void report(ostream &out) {
+		out << "zone\tmin us\tavg us\tp99 us\tcalls" << endl;
+		for (ZoneStats &stat : stats()) {
+			out << string(stat.depth * 2, ' ') << stat.name << "\t" << stat.min / 1000 << "\t" << stat.avg / 1000 << "\t" << stat.p99 / 1000 << "\t" << stat.calls << endl;
+		}
+
+		lock_guard<mutex> lock(registryMutex);
+		for (unique_ptr<ProfileBuffer> &buffer : buffers) {
+			unsigned long long dropped = buffer->dropped.load();
+			if (dropped > 0) out << "thread " << buffer->threadIndex << " dropped " << dropped << " events" << endl;
+		}
+	}
+
+	//Keep every event drained from now on for trace export
+	void startCapture() {
+		trace.clear();
+		capturing = true;
+	}
+	void stopCapture() {
+		capturing = false;
+	}
+
+	//Write captured events in Chrome trace format (chrome://tracing, Perfetto)
+	bool writeChromeTrace(string path) {
+		ofstream out(path);
+		if (!out) return false;
+
+		out << "{\"traceEvents\":[" << endl;
+		{
+			lock_guard<mutex> lock(registryMutex);
+			for (unique_ptr<ProfileBuffer> &buffer : buffers) {
+				string name = buffer->threadName.empty() ? "thread " + to_string(buffer->threadIndex) : buffer->threadName;
+				out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":" << buffer->threadIndex << ",\"args\":{\"name\":\"" << escape(name) << "\"}}," << endl;
+			}
+		}
+		out << "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":0,\"tid\":" << FRAME_TRACK << ",\"args\":{\"name\":\"frames\"}}";
+		for (TraceEvent &traced : trace) {
+			const ProfileEvent &event = traced.event;
+			const char* name = event.site != NULL ? event.site->name : "frame";
+			out << "," << endl << "{\"ph\":\"X\",\"name\":\"" << escape(name) << "\",\"cat\":\"cpu\",\"pid\":0,\"tid\":" << traced.threadIndex;
+			out << ",\"ts\":" << fixed << event.begin / 1000.0 << ",\"dur\":" << (event.end - event.begin) / 1000.0 << "}";
+		}
+		out << endl << "]}" << endl;
+		return true;
+	}
+
+private:
+	struct Zone {
+		string name;
+		int depth = 0;
+		long long frameTotal = 0;
+		int frameCalls = 0;
+		int lastCalls = 0;
+		vector<long long> history;
+		long long firstFrame = 0;	//frameCount when the history started
+	};
+
+	//Quote a name for a JSON string
+	static string escape(const string &text) {
+		string escaped;
+		for (char c : text) {
+			if (c == '"' || c == '\\') escaped += '\\';
+			if ((unsigned char)c < 0x20) {
+				char code[8];
+				snprintf(code, sizeof(code), "\\u%04x", c);
+				escaped += code;
+			}
+			else escaped += c;
+		}
+		return escaped;
+	}
+
+	struct TraceEvent {
+		ProfileEvent event;
+		int threadIndex;
+	};
+
+	chrono::time_point<chrono::steady_clock> epoch = chrono::steady_clock::now();
+	mutex registryMutex;
+	vector<unique_ptr<ProfileBuffer>> buffers;
+	map<string, int> zoneIndex;
+	vector<Zone> zones;
+	long long frameCount = 0;
+	long long frameStart = 0;
+	bool capturing = false;
+	vector<TraceEvent> trace;
+
+	Profiler() {
+	}
+};
+
+inline ProfileSite::ProfileSite(const char* name, const char* file, int line) {
+	this->name = name;
+	this->file = file;
+	this->line = line;
+	this->zone = Profiler::instance().intern(name);
+}
+
+//Times the enclosing scope. Nested zones are recorded with their depth.
+class ProfileZone {
+public:
+	ProfileZone(const ProfileSite* site) {
+		this->site = site;
+		depth = Profiler::threadDepth()++;
+		begin = Profiler::now();
+	}
+
+	~ProfileZone() {
+		long long end = Profiler::now();
+		Profiler::threadDepth()--;
+		Profiler::threadBuffer()->push(ProfileEvent{ site, begin, end, depth });
+	}
+
+private:
+	const ProfileSite* site;
+	long long begin;
+	int depth;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+//Usage: PROFILE_ZONE("name"); at the top of a scope. The name must be a string literal.
+#define PROFILE_ZONE(name) \
+	static const ProfileSite PROFILE_CONCAT(profileSite, __LINE__)(name, __FILE__, __LINE__); \
+	ProfileZone PROFILE_CONCAT(profileZone, __LINE__)(&PROFILE_CONCAT(profileSite, __LINE__))
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef PROGRAM_CACHE_H
+#define PROGRAM_CACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <glad/glad.h>
+#include "GLExtensions.h"
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+using namespace std;
+
+//On-disk cache of linked program binaries (GL_ARB_get_program_binary).
+//Entries are keyed by the shader sources and the driver identity, so an edited shader or
+//a driver update simply misses and the program is compiled again. Defines need no key of
+//their own, ShaderPreprocessor writes them into the sources.
+class ProgramCache {
+public:
+	ProgramCache(string directory) {
+		this->directory = directory;
+#ifdef _WIN32
+		_mkdir(directory.c_str());
+#else
+		mkdir(directory.c_str(), 0755);
+#endif
+	}
+
+	//Program binaries are optional; without them every lookup misses
+	bool isEnabled() {
+		return GLExtensions::get().programBinary;
+	}
+
+	//64-bit FNV-1a over everything that can change the compiled program
+	string key(const vector<string> &sources) {
+		unsigned long long hash = 14695981039346656037ULL;
+		for (const string &source : sources) hash = fnv1a(hash, source);
+		hash = fnv1a(hash, driverString(GL_VENDOR));
+		hash = fnv1a(hash, driverString(GL_RENDERER));
+		hash = fnv1a(hash, driverString(GL_VERSION));
+
+		char hex[17];
+		snprintf(hex, sizeof(hex), "%016llx", hash);
+		return hex;
+	}
+
+	//Load a cached binary into program. Returns false if it is missing or the driver rejects it.
+	bool load(string key, unsigned int program) {
+		if (!isEnabled()) return false;
+
+		ifstream in(path(key), ios::binary);
+		if (!in) return false;
+
+		Header header;
+		in.read((char*)&header, sizeof(header));
+		if (!in || header.magic != MAGIC || header.length <= 0) return false;
+
+		vector<char> binary(header.length);
+		in.read(binary.data(), header.length);
+		if (!in) return false;
+
+		GLExtensions::get().programBinaryLoad(program, header.format, binary.data(), header.length);
+
+		int success;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) remove(path(key).c_str());
+		return success != 0;
+	}
+
+	//Mark a program so the driver keeps its binary around. Call before linking.
+	void prepare(unsigned int program) {
+		if (isEnabled()) GLExtensions::get().programParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+	}
+
+	//Store the binary of a linked program
+	bool store(string key, unsigned int program) {
+		if (!isEnabled()) return false;
+
+		Header header;
+		header.magic = MAGIC;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &header.length);
+		if (header.length <= 0) return false;
+
+		vector<char> binary(header.length);
+		GLsizei length = 0;
+		GLenum format = 0;
+		GLExtensions::get().getProgramBinary(program, header.length, &length, &format, binary.data());
+		if (length <= 0) return false;
+		header.format = format;
+		header.length = length;
+
+		//Write to a temporary file first so a crash never leaves a truncated entry
+		string target = path(key);
+		string temporary = target + ".tmp";
+		{
+			ofstream out(temporary, ios::binary);
+			if (!out) return false;
+			out.write((const char*)&header, sizeof(header));
+			out.write(binary.data(), length);
+			if (!out) return false;
+		}
+		remove(target.c_str());
+		return rename(temporary.c_str(), target.c_str()) == 0;
+	}
+
+private:
+	static const unsigned int MAGIC = 0x42504c47;	//"GLPB"
+
+	struct Header {
+		unsigned int magic;
+		GLenum format;
+		GLint length;
+	};
+
+	string directory;
+
+	string path(string key) {
+		return directory + "/" + key + ".bin";
+	}
+
+	static string driverString(GLenum name) {
+		const char* value = (const char*)glGetString(name);
+		return value != NULL ? value : "";
+	}
+
+	static unsigned long long fnv1a(unsigned long long hash, const string &data) {
+		for (unsigned char c : data) {
+			hash ^= c;
+			hash *= 1099511628211ULL;
+		}
+		//Separator so that ("ab", "c") and ("a", "bc") hash differently
+		hash ^= 0xff;
+		hash *= 1099511628211ULL;
+		return hash;
+	}
+};
+
+#endif
@@ -4,78 +4,255 @@
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <map>
 #include <glad/glad.h>
 #include <glm/glm.hpp>
+#include "GLExtensions.h"
+#include "ProgramCache.h"
+#include "Uniform.h"
 
 using namespace std;
 
 class Shader {
 public:
-	unsigned int ID;
+	enum State {
+		EMPTY,		//Nothing submitted
+		PENDING,	//Compiling or linking, results not collected yet
+		READY,		//Linked and reflected
+		FAILED
+	};
+
+	unsigned int ID = 0;
+
+	Shader() {
+	}
 
 	Shader(const char* vertexShaderPath, const char* fragmentShaderPath, const char* geometryShaderPath = NULL) {
-		int success;
+		//Build program and wait for it
+		compileAsync(vertexShaderPath, fragmentShaderPath, geometryShaderPath);
+		finish();
+	}
 
-		//Load and compile shaders
-		int vertexShader;
-		success = compileShader(vertexShaderPath, &vertexShader, GL_VERTEX_SHADER);
-		if (!success) return;
+	//Start compiling and linking without waiting for the driver. Use poll() or finish()
+	//to collect the result; until then the program must not be used.
+	void compileAsync(const char* vertexShaderPath, const char* fragmentShaderPath, const char* geometryShaderPath = NULL) {
+		//Load shader sources
+		vector<string> sources;
+		sources.push_back(ReadStringFromFile(vertexShaderPath));
+		sources.push_back(ReadStringFromFile(fragmentShaderPath));
+		if (geometryShaderPath != NULL) sources.push_back(ReadStringFromFile(geometryShaderPath));
+		submit(sources);
+	}
 
-		int fragmentShader;
-		success = compileShader(fragmentShaderPath, &fragmentShader, GL_FRAGMENT_SHADER);
-		if (!success) return;
+	//Same with sources already in memory, e.g. expanded by ShaderPreprocessor.
+	//shared is a shader still compiling the same sources: its stages are linked into this
+	//program instead of being compiled again.
+	void compileAsync(const vector<string> &sources, const Shader* shared = NULL) {
+		submit(sources, shared);
+	}
 
-		int geometryShader;
-		if (geometryShaderPath != NULL) {
-			success = compileShader(geometryShaderPath, &geometryShader, GL_GEOMETRY_SHADER);
-			if (!success) return;
+	//Collect the result if the driver has finished. Never blocks when
+	//GL_KHR_parallel_shader_compile is available; without it there is no way to ask, so this
+	//waits for the driver like finish(). Returns true once the shader is no longer pending.
+	bool poll() {
+		if (state != PENDING) return true;
+		if (GLExtensions::get().parallelShaderCompile) {
+			int complete = 0;
+			glGetProgramiv(ID, GL_COMPLETION_STATUS_KHR, &complete);
+			if (!complete) return false;
 		}
+		finish();
+		return true;
+	}
 
-		//Create program and link shaders
-		ID = glCreateProgram();
-		glAttachShader(ID, vertexShader);
-		glAttachShader(ID, fragmentShader);
-		if (geometryShaderPath != NULL)glAttachShader(ID, geometryShader);
-		glLinkProgram(ID);
-
-		//Delete shader
-		glDeleteShader(vertexShader);
-		glDeleteShader(fragmentShader);
-		if (geometryShaderPath != NULL)glDeleteShader(geometryShader);
+	//Collect the result, waiting for the driver if needed. Returns true if the program is usable.
+	bool finish() {
+		if (state != PENDING) return state == READY;
 
 		//Error
-		glGetProgramiv(ID, GL_LINK_STATUS, &success);
-		if (!success&&verbose) {
-			char logStr[1024];
-			glGetProgramInfoLog(ID, 512, NULL, logStr);
-			log(logStr);
+		int success = 1;
+		for (unsigned int stage : stages) {
+			int compiled;
+			glGetShaderiv(stage, GL_COMPILE_STATUS, &compiled);
+			if (!compiled&&verbose) {
+				char logStr[1024];
+				glGetShaderInfoLog(stage, 512, NULL, logStr);
+				log(logStr);
+			}
+			if (!compiled) success = 0;
+		}
+		if (success) {
+			glGetProgramiv(ID, GL_LINK_STATUS, &success);
+			if (!success&&verbose) {
+				char logStr[1024];
+				glGetProgramInfoLog(ID, 512, NULL, logStr);
+				log(logStr);
+			}
 		}
+
+		//Delete shader
+		for (unsigned int stage : stages) glDeleteShader(stage);
+		stages.clear();
+
+		//Save the binary for the next launch
+		ProgramCache* cache = programCache();
+		if (success && cache != NULL) cache->store(cacheKey, ID);
+
+		//Reflect uniforms
+		if (success) uniforms.build(ID);
+		state = success ? READY : FAILED;
+		return state == READY;
+	}
+
+	State getState() {
+		return state;
+	}
+	bool isReady() {
+		return state == READY;
+	}
+
+	//Cache used by every Shader constructed afterwards. NULL disables caching.
+	static void setProgramCache(ProgramCache* cache) {
+		programCache() = cache;
 	}
 
 	void setVerbose(int verbose) {
 		this->verbose = verbose;
 	}
 
+	//Location from the reflected uniform table, -1 if the uniform is not active
 	unsigned int getUniformLocation(const char* name) {
-		return glGetUniformLocation(ID, name);
+		return uniforms.location(name);
+	}
+
+	//Reflected layout of a uniform block, NULL if the program has no such active block
+	const UniformBlock* uniformBlock(const char* name) {
+		return uniforms.block(name);
+	}
+
+	//Source the named uniform block from a uniform buffer binding point
+	bool bindUniformBlock(const char* name, unsigned int binding) {
+		const UniformBlock* block = uniforms.block(name);
+		if (block == NULL) {
+			if (verbose) log(string("Uniform block not found: ") + name);
+			return false;
+		}
+		glUniformBlockBinding(ID, block->index, binding);
+		blockBindings[name] = binding;
+		return true;
+	}
+
+	//Take over the program of another shader, typically a recompiled version of this one.
+	//Uniform values and block bindings set through this shader carry over to the new program,
+	//handles do not: resolve them again when getGeneration() changes. other is left empty.
+	bool adopt(Shader &other) {
+		if (!other.isReady()) return false;
+
+		GLint current = 0;
+		glGetIntegerv(GL_CURRENT_PROGRAM, &current);
+		glUseProgram(other.ID);
+		for (const pair<const string, unsigned int> &binding : blockBindings) {
+			const UniformBlock* block = other.uniforms.block(binding.first.c_str());
+			if (block != NULL) glUniformBlockBinding(other.ID, block->index, binding.second);
+		}
+		for (int i = 0;i < (int)uniforms.entries.size();i++) {
+			const UniformTable::Entry &entry = uniforms.entries[i];
+			const void* value = uniforms.value(i);
+			int index = other.uniforms.find(entry.name.c_str());
+			if (value == NULL || index < 0 || other.uniforms.entries[index].type != entry.type) continue;
+			if (other.uniforms.update(index, value, entry.size)) UniformTable::upload(other.uniforms.entries[index].location, entry.type, value);
+		}
+		glUseProgram((unsigned int)current == ID ? other.ID : current);
+
+		glDeleteProgram(ID);
+		ID = other.ID;
+		uniforms = other.uniforms;
+		state = READY;
+		generation++;
+		other.ID = 0;
+		other.state = EMPTY;
+		return true;
+	}
+
+	//Incremented every time the program is replaced through adopt()
+	unsigned int getGeneration() {
+		return generation;
+	}
+
+	//Resolve a typed handle. Invalid if the uniform is missing or of another type.
+	template<typename T>
+	Uniform<T> uniform(const char* name) {
+		Uniform<T> handle;
+		int index = uniforms.find(name);
+		if (index < 0) {
+			if (verbose) log(string("Uniform not found: ") + name);
+			return handle;
+		}
+		if (!uniformTypeMatches((T*)NULL, uniforms.entries[index].type)) {
+			if (verbose) log(string("Uniform type mismatch: ") + name);
+			return handle;
+		}
+		handle.location = uniforms.entries[index].location;
+		handle.index = index;
+		return handle;
+	}
+
+	//Upload through a handle. The program must be in use.
+	//Values equal to the last upload are skipped, see uniformUploads/uniformSkips.
+	void set(Uniform<int> handle, int value) {
+		if (changed(handle.index, &value, sizeof(value))) glUniform1i(handle.location, value);
+	}
+	void set(Uniform<unsigned int> handle, unsigned int value) {
+		if (changed(handle.index, &value, sizeof(value))) glUniform1ui(handle.location, value);
+	}
+	void set(Uniform<float> handle, float value) {
+		if (changed(handle.index, &value, sizeof(value))) glUniform1f(handle.location, value);
+	}
+	void set(Uniform<glm::vec2> handle, const glm::vec2 &value) {
+		if (changed(handle.index, &value[0], sizeof(value))) glUniform2fv(handle.location, 1, &value[0]);
+	}
+	void set(Uniform<glm::vec3> handle, const glm::vec3 &value) {
+		if (changed(handle.index, &value[0], sizeof(value))) glUniform3fv(handle.location, 1, &value[0]);
+	}
+	void set(Uniform<glm::vec4> handle, const glm::vec4 &value) {
+		if (changed(handle.index, &value[0], sizeof(value))) glUniform4fv(handle.location, 1, &value[0]);
+	}
+	void set(Uniform<glm::mat3> handle, const glm::mat3 &value) {
+		if (changed(handle.index, &value[0][0], sizeof(value))) glUniformMatrix3fv(handle.location, 1, GL_FALSE, &value[0][0]);
+	}
+	void set(Uniform<glm::mat4> handle, const glm::mat4 &value) {
+		if (changed(handle.index, &value[0][0], sizeof(value))) glUniformMatrix4fv(handle.location, 1, GL_FALSE, &value[0][0]);
 	}
 
 	int setInt(const char* name, unsigned int value) {
-		unsigned int location = glGetUniformLocation(ID, name);
+		unsigned int location = uniforms.location(name);
 		updateInt(location, value);
 		return location;
 	}
 	void updateInt(unsigned int location, int value) {
-		glUniform1i(location, value);
+		if (changed(uniforms.indexOfLocation(location), &value, sizeof(value))) glUniform1i(location, value);
 	}
 
 	int setMatrix4(const char* name, glm::mat4 &value) {
-		unsigned int location = glGetUniformLocation(ID, name);
+		unsigned int location = uniforms.location(name);
 		updateMatrix4(location, value);
 		return location;
 	}
 	void updateMatrix4(unsigned int location, glm::mat4 &value) {
-		glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+		if (changed(uniforms.indexOfLocation(location), &value[0][0], sizeof(value))) glUniformMatrix4fv(location, 1, GL_FALSE, &value[0][0]);
+	}
+
+	//glUniform calls issued and skipped since the last resetUniformCounters
+	unsigned int uniformUploads() {
+		return uploads;
+	}
+	unsigned int uniformSkips() {
+		return skips;
+	}
+	void resetUniformCounters() {
+		uploads = 0;
+		skips = 0;
 	}
 
 	void use() {
@@ -87,6 +264,24 @@ public:
 
 private:
 	int verbose = false;
+	State state = EMPTY;
+	vector<unsigned int> stages;	//Shader objects until the result is collected
+	string cacheKey;
+	UniformTable uniforms;
+	map<string, unsigned int> blockBindings;
+	unsigned int generation = 0;
+	unsigned int uploads = 0;
+	unsigned int skips = 0;
+
+	//Update the shadow copy and count the call
+	bool changed(int index, const void* value, int size) {
+		if (uniforms.update(index, value, size)) {
+			uploads++;
+			return true;
+		}
+		skips++;
+		return false;
+	}
 
 	void log(string message) {
 		cout << message << endl;
@@ -98,27 +293,49 @@ private:
 		return contents;
 	}
 
-	//This method loads the shader source from the given file paths and compile.
-	int compileShader(string shaderPath, int* shader, GLenum type) {
-		//Load shader source
-		string str = ReadStringFromFile(shaderPath);
-		const char* fragmentShaderSource = str.c_str();
+	//Create the program from the stage sources (vertex, fragment, optional geometry),
+	//or load it from the program cache. Nothing here waits for the compiler.
+	void submit(const vector<string> &sources, const Shader* shared = NULL) {
+		static const GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER };
+		state = PENDING;
 
-		//Create shader and compile
-		*shader = glCreateShader(type);
-		glShaderSource(*shader, 1, &fragmentShaderSource, NULL);
-		glCompileShader(*shader);
+		//Use the cached program binary when the sources and driver match
+		ID = glCreateProgram();
+		ProgramCache* cache = programCache();
+		if (cache != NULL) {
+			cacheKey = cache->key(sources);
+			if (cache->load(cacheKey, ID)) {
+				uniforms.build(ID);
+				state = READY;
+				return;
+			}
+		}
 
-		//Error
-		int success;
-		glGetShaderiv(*shader, GL_COMPILE_STATUS, &success);
-		if (!success&&verbose) {
-			char logStr[1024];
-			glGetShaderInfoLog(*shader, 512, NULL, logStr);
-			log(logStr);
+		//Compile and link shaders. Stages stay alive while attached to a program, so deleting
+		//them in both shaders' finish() is safe.
+		if (shared != NULL && shared->state == PENDING && shared->stages.size() == sources.size()) stages = shared->stages;
+		else {
+			for (size_t i = 0;i < sources.size() && i < 3;i++) stages.push_back(compileShader(sources[i], types[i]));
 		}
+		for (unsigned int stage : stages) glAttachShader(ID, stage);
+		if (cache != NULL) cache->prepare(ID);
+		glLinkProgram(ID);
+	}
 
-		return success;
+	static ProgramCache*& programCache() {
+		static ProgramCache* cache = NULL;
+		return cache;
+	}
+
+	//This method starts compiling the given shader source.
+	unsigned int compileShader(const string &source, GLenum type) {
+		const char* shaderSource = source.c_str();
+
+		//Create shader and compile
+		unsigned int shader = glCreateShader(type);
+		glShaderSource(shader, 1, &shaderSource, NULL);
+		glCompileShader(shader);
+		return shader;
 	}
 };
 
@@ -0,0 +1,87 @@
+#ifndef SHADER_COMPILER_H
+#define SHADER_COMPILER_H
+
+#include <vector>
+#include <memory>
+#include "Shader.h"
+#include "GLExtensions.h"
+
+using namespace std;
+
+//Compiles many programs at once without blocking the render loop.
+//Submit every program up front so the driver can work on all of them, then call poll()
+//once per frame and draw with select(shader, fallback) until a program is ready.
+//
+//With GL_KHR_parallel_shader_compile the driver compiles on its own threads and poll()
+//only collects programs it reports as complete. Without it, every program poll() collects
+//blocks until the driver has compiled and linked it, so poll() collects at most budget
+//programs per call to spread the stall over several frames.
+class ShaderCompiler {
+public:
+	ShaderCompiler() {
+		GLExtensions &extensions = GLExtensions::get();
+		if (extensions.maxShaderCompilerThreads != NULL) extensions.maxShaderCompilerThreads(0xFFFFFFFF);
+	}
+
+	//The returned shader is owned by the compiler and stays valid for its lifetime
+	Shader* submit(const char* vertexShaderPath, const char* fragmentShaderPath, const char* geometryShaderPath = NULL) {
+		shaders.push_back(unique_ptr<Shader>(new Shader()));
+		Shader* shader = shaders.back().get();
+		shader->setVerbose(verbose);
+		shader->compileAsync(vertexShaderPath, fragmentShaderPath, geometryShaderPath);
+		if (shader->getState() == Shader::PENDING) pending.push_back(shader);
+		return shader;
+	}
+
+	//Stage sources in vertex, fragment, geometry order. See Shader::compileAsync() for shared.
+	Shader* submit(const vector<string> &sources, const Shader* shared = NULL) {
+		shaders.push_back(unique_ptr<Shader>(new Shader()));
+		Shader* shader = shaders.back().get();
+		shader->setVerbose(verbose);
+		shader->compileAsync(sources, shared);
+		if (shader->getState() == Shader::PENDING) pending.push_back(shader);
+		return shader;
+	}
+
+	//Collect finished programs. Returns the number still pending.
+	int poll(int budget = 1) {
+		bool parallel = GLExtensions::get().parallelShaderCompile;
+		for (size_t i = 0;i < pending.size();) {
+			if (!parallel && budget <= 0) break;
+
+			if (pending[i]->poll()) {
+				pending.erase(pending.begin() + i);
+				budget--;
+			}
+			else i++;
+		}
+		return (int)pending.size();
+	}
+
+	//Collect every program, waiting for the driver
+	void finish() {
+		for (Shader* shader : pending) shader->finish();
+		pending.clear();
+	}
+
+	bool isDone() {
+		return pending.empty();
+	}
+
+	void setVerbose(int verbose) {
+		this->verbose = verbose;
+	}
+
+	//Shader to draw with this frame, NULL if neither is ready
+	static Shader* select(Shader* shader, Shader* fallback) {
+		if (shader != NULL && shader->isReady()) return shader;
+		return fallback != NULL && fallback->isReady() ? fallback : NULL;
+	}
+
+private:
+	vector<unique_ptr<Shader>> shaders;
+	vector<Shader*> pending;
+	int verbose = false;
+};
+
+#endif
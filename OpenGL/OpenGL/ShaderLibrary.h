@@ -0,0 +1,214 @@
+#ifndef SHADER_LIBRARY_H
+#define SHADER_LIBRARY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <memory>
+#include "Shader.h"
+#include "ShaderCompiler.h"
+#include "ShaderPreprocessor.h"
+#include "FileWatcher.h"
+
+using namespace std;
+
+//Permutation cache on top of ShaderPreprocessor and ShaderCompiler.
+//A permutation is a set of stage files plus a list of defines. Requesting the same
+//permutation twice returns the same Shader. Permutations whose expanded sources are
+//identical share their compiled stages, so each distinct source set is compiled once,
+//but each links a program of its own: an edit that makes their defines matter only
+//recompiles the ones that changed.
+//
+//With hot reload enabled, update() watches every file a permutation was built from. A
+//changed permutation is compiled again in the background with its own defines and swapped
+//into its Shader once it links; if it fails the old program stays in use. Without
+//GL_KHR_parallel_shader_compile the update() after an edit waits for the recompile.
+class ShaderLibrary {
+public:
+	ShaderLibrary(ShaderCompiler &compiler) : compiler(compiler) {
+	}
+
+	~ShaderLibrary() {
+		for (unique_ptr<Permutation> &permutation : list) {
+			if (permutation->reload) glDeleteProgram(permutation->reload->ID);
+		}
+	}
+
+	//Owned by the compiler. NULL if a stage could not be preprocessed.
+	Shader* get(const char* vertexShaderPath, const char* fragmentShaderPath, const vector<string> &defines = vector<string>(), const char* geometryShaderPath = NULL) {
+		vector<string> paths;
+		paths.push_back(vertexShaderPath);
+		paths.push_back(fragmentShaderPath);
+		if (geometryShaderPath != NULL) paths.push_back(geometryShaderPath);
+
+		//Same files and defines
+		string name;
+		for (const string &path : paths) name += path + "\n";
+		for (const string &define : defines) name += "#" + define + "\n";
+		map<string, Permutation*>::iterator found = permutations.find(name);
+		if (found != permutations.end()) return found->second->shader;
+
+		vector<string> sources, files;
+		unsigned long long hash;
+		if (!expand(paths, defines, sources, files, hash)) return NULL;
+
+		list.push_back(unique_ptr<Permutation>(new Permutation()));
+		Permutation* permutation = list.back().get();
+		permutation->shader = compiler.submit(sources, compiling(hash));
+		permutation->paths = paths;
+		permutation->defines = defines;
+		permutation->files = files;
+		permutation->hash = hash;
+		if (hotReload) watch(*permutation);
+		permutations[name] = permutation;
+		return permutation->shader;
+	}
+
+	//Watch the sources of every program from now on
+	void setHotReload(bool enabled) {
+		hotReload = enabled;
+		if (enabled) {
+			for (unique_ptr<Permutation> &permutation : list) watch(*permutation);
+		}
+	}
+
+	//Call once per frame between frames. Starts recompiling permutations whose files changed
+	//and swaps in those that finished. Returns the number of programs swapped.
+	int update() {
+		if (!hotReload) return 0;
+
+		for (const string &file : watcher.poll()) {
+			if (verbose) log("Changed: " + file);
+			preprocessor.invalidate(file);
+			for (unique_ptr<Permutation> &permutation : list) {
+				for (const string &dependency : permutation->files) {
+					if (dependency == file) permutation->dirty = true;
+				}
+			}
+		}
+
+		int swapped = 0;
+		for (unique_ptr<Permutation> &permutation : list) {
+			if (permutation->reload) {
+				if (!permutation->reload->poll()) continue;
+				swapped += finishReload(*permutation);
+			}
+			if (permutation->dirty) startReload(*permutation);
+		}
+		return swapped;
+	}
+
+	//Distinct permutations requested and distinct expanded sources among them
+	int permutationCount() {
+		return (int)permutations.size();
+	}
+	int sourceCount() {
+		set<unsigned long long> hashes;
+		for (unique_ptr<Permutation> &permutation : list) hashes.insert(permutation->hash);
+		return (int)hashes.size();
+	}
+
+	ShaderPreprocessor& getPreprocessor() {
+		return preprocessor;
+	}
+
+	void setVerbose(int verbose) {
+		this->verbose = verbose;
+		preprocessor.setVerbose(verbose);
+	}
+
+private:
+	struct Permutation {
+		Shader* shader = NULL;			//Owned by the compiler
+		vector<string> paths;
+		vector<string> defines;
+		vector<string> files;			//Every file the stages were expanded from
+		unsigned long long hash = 0;	//Of the expanded stage sources
+		unique_ptr<Shader> reload;		//Compiling replacement
+		unsigned long long reloadHash = 0;
+		bool dirty = false;
+	};
+
+	ShaderCompiler &compiler;
+	ShaderPreprocessor preprocessor;
+	FileWatcher watcher;
+	vector<unique_ptr<Permutation>> list;
+	map<string, Permutation*> permutations;
+	bool hotReload = false;
+	int verbose = false;
+
+	void log(string message) {
+		cout << message << endl;
+	}
+
+	//Preprocess every stage. files receives every file read, hash covers all expanded sources.
+	bool expand(const vector<string> &paths, const vector<string> &defines, vector<string> &sources, vector<string> &files, unsigned long long &hash) {
+		hash = 14695981039346656037ULL;
+		for (const string &path : paths) {
+			ShaderPreprocessor::Source source = preprocessor.expand(path, defines);
+			if (!source.ok) {
+				if (verbose) log("Cannot preprocess " + path + ": " + source.error);
+				return false;
+			}
+			sources.push_back(source.text);
+			files.insert(files.end(), source.files.begin(), source.files.end());
+			hash = (hash ^ source.hash) * 1099511628211ULL;
+		}
+		return true;
+	}
+
+	//A shader still compiling these sources, whose stages a new program can link
+	const Shader* compiling(unsigned long long hash) {
+		for (unique_ptr<Permutation> &permutation : list) {
+			if (permutation->reload && permutation->reloadHash == hash) return permutation->reload.get();
+			if (permutation->hash == hash && permutation->shader->getState() == Shader::PENDING) return permutation->shader;
+		}
+		return NULL;
+	}
+
+	static string describe(const Permutation &permutation) {
+		string paths;
+		for (const string &path : permutation.paths) paths += (paths.empty() ? "" : ", ") + path;
+		for (const string &define : permutation.defines) paths += " #" + define;
+		return paths;
+	}
+
+	void watch(const Permutation &permutation) {
+		for (const string &file : permutation.files) watcher.add(file);
+	}
+
+	void startReload(Permutation &permutation) {
+		permutation.dirty = false;
+
+		//A file that fails to preprocess, e.g. half saved, is retried on its next change
+		vector<string> sources, files;
+		unsigned long long hash;
+		if (!expand(permutation.paths, permutation.defines, sources, files, hash)) return;
+		permutation.files = files;
+		watch(permutation);
+		if (hash == permutation.hash) return;
+
+		const Shader* shared = compiling(hash);
+		permutation.reload.reset(new Shader());
+		permutation.reload->setVerbose(verbose);
+		permutation.reload->compileAsync(sources, shared);
+		permutation.reloadHash = hash;
+	}
+
+	int finishReload(Permutation &permutation) {
+		unique_ptr<Shader> reload(move(permutation.reload));
+		if (!permutation.shader->adopt(*reload)) {
+			if (verbose) log("Reload failed, keeping the previous program: " + describe(permutation));
+			glDeleteProgram(reload->ID);
+			return 0;
+		}
+
+		permutation.hash = permutation.reloadHash;
+		if (verbose) log("Reloaded " + describe(permutation));
+		return 1;
+	}
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef SHADER_PREPROCESSOR_H
+#define SHADER_PREPROCESSOR_H
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cctype>
+
+using namespace std;
+
+//Expands #include "file" directives and injects #define permutations into GLSL sources.
+//Included paths are relative to the including file. Each file is included once, which
+//also makes include cycles harmless.
+//#line directives keep compiler errors pointing at the right file and line; the source
+//string number in an error is the index into Source::files.
+//
+//Defines that the expanded source never mentions are dropped, so permutations that do
+//not affect a stage produce identical text and share one compiled program.
+class ShaderPreprocessor {
+public:
+	struct Source {
+		string text;
+		vector<string> files;			//Every file read, the root first
+		unsigned long long hash = 0;	//64-bit FNV-1a of text
+		bool ok = false;
+		string error;
+	};
+
+	//defines are "NAME" or "NAME value"
+	Source expand(string path, const vector<string> &defines = vector<string>()) {
+		Source source;
+		string version;
+		string body;
+		source.ok = expandFile(path, source, version, body);
+		if (!source.ok) {
+			if (verbose) log(source.error);
+			return source;
+		}
+
+		string header = version;
+		for (const string &define : defines) {
+			string name = define.substr(0, define.find_first_of(" \t("));
+			if (mentions(body, name)) header += "#define " + define + "\n";
+		}
+		//Number the body from its first line again, it may start before #version or have no #version at all
+		if (!header.empty()) header += "#line 1 0\n";
+
+		source.text = header + body;
+		source.hash = hash(source.text);
+		return source;
+	}
+
+	//Drop the cached contents of a file so the next expansion reads it again
+	void invalidate(string path) {
+		files.erase(path);
+	}
+	void invalidateAll() {
+		files.clear();
+	}
+
+	void setVerbose(int verbose) {
+		this->verbose = verbose;
+	}
+
+	static unsigned long long hash(const string &text) {
+		unsigned long long h = 14695981039346656037ULL;
+		for (unsigned char c : text) {
+			h ^= c;
+			h *= 1099511628211ULL;
+		}
+		return h;
+	}
+
+private:
+	map<string, string> files;	//Contents by path, read once
+	int verbose = false;
+
+	void log(string message) {
+		cout << message << endl;
+	}
+
+	bool read(const string &path, string &contents) {
+		map<string, string>::iterator found = files.find(path);
+		if (found != files.end()) {
+			contents = found->second;
+			return true;
+		}
+
+		ifstream in(path);
+		if (!in) return false;
+		contents.assign((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		files[path] = contents;
+		return true;
+	}
+
+	static string directoryOf(const string &path) {
+		size_t slash = path.find_last_of("/\\");
+		return slash == string::npos ? "" : path.substr(0, slash + 1);
+	}
+
+	bool expandFile(const string &path, Source &source, string &version, string &body) {
+		string contents;
+		if (!read(path, contents)) {
+			source.error = "Cannot read " + path;
+			return false;
+		}
+
+		int fileIndex = (int)source.files.size();
+		source.files.push_back(path);
+
+		bool root = fileIndex == 0;
+		istringstream lines(contents);
+		string line;
+		int lineNumber = 0;
+		if (!root) body += "#line 1 " + to_string(fileIndex) + "\n";
+
+		while (getline(lines, line)) {
+			lineNumber++;
+			size_t start = line.find_first_not_of(" \t");
+			string directive = start == string::npos ? "" : line.substr(start);
+
+			//#version has to stay the first statement, defines go right after it
+			if (root && version.empty() && directive.compare(0, 8, "#version") == 0) {
+				version = line + "\n";
+				body += "#line " + to_string(lineNumber + 1) + " " + to_string(fileIndex) + "\n";
+				continue;
+			}
+
+			if (directive.compare(0, 8, "#include") == 0) {
+				size_t open = directive.find_first_of("\"<", 8);
+				size_t close = open == string::npos ? string::npos : directive.find_first_of("\">", open + 1);
+				if (close == string::npos) {
+					source.error = path + ":" + to_string(lineNumber) + ": malformed #include";
+					return false;
+				}
+
+				string included = directoryOf(path) + directive.substr(open + 1, close - open - 1);
+				bool seen = false;
+				for (const string &file : source.files) seen = seen || file == included;
+				if (!seen && !expandFile(included, source, version, body)) return false;
+
+				body += "#line " + to_string(lineNumber + 1) + " " + to_string(fileIndex) + "\n";
+				continue;
+			}
+
+			body += line + "\n";
+		}
+		return true;
+	}
+
+	//True if name occurs in text as a whole identifier
+	static bool mentions(const string &text, const string &name) {
+		if (name.empty()) return false;
+		for (size_t at = text.find(name);at != string::npos;at = text.find(name, at + 1)) {
+			bool startOk = at == 0 || !isIdentifier(text[at - 1]);
+			bool endOk = at + name.size() >= text.size() || !isIdentifier(text[at + name.size()]);
+			if (startOk && endOk) return true;
+		}
+		return false;
+	}
+
+	static bool isIdentifier(char c) {
+		return isalnum((unsigned char)c) || c == '_';
+	}
+};
+
+#endif
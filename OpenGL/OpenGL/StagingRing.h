@@ -0,0 +1,208 @@
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <cstring>
+#include <glad/glad.h>
+#include "GLExtensions.h"
+
+using namespace std;
+
+//Ring of upload memory shared by texture and buffer uploads.
+//With GL_ARB_buffer_storage the ring is one persistently mapped buffer: any thread may
+//allocate a region and write pixels or vertices straight into GPU visible memory, and the
+//render thread uploads from it without copying. Otherwise regions live in client memory
+//and flush() copies them into the buffer first.
+//
+//Regions are reclaimed in allocation order. After issuing the GL commands that read a
+//region, the render thread calls submit(), which fences it; reclaim() frees regions
+//whose fence has signaled. release() returns a region that was never used.
+class StagingRing {
+public:
+	struct Allocation {
+		unsigned char* data = NULL;	//Write the contents here
+		GLintptr offset = 0;		//Offset in the buffer, for glTexSubImage2D and glCopyBufferSubData
+		size_t size = 0;
+		unsigned long long id = 0;
+
+		bool isValid() const {
+			return data != NULL;
+		}
+	};
+
+	static const size_t ALIGNMENT = 64;
+
+	unsigned int ID = 0;
+
+	StagingRing(size_t capacity = 32 * 1024 * 1024) {
+		this->capacity = capacity;
+		glGenBuffers(1, &ID);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+
+		GLExtensions &extensions = GLExtensions::get();
+		if (extensions.bufferStorage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			extensions.bufferStorageAllocate(GL_COPY_WRITE_BUFFER, capacity, NULL, flags | GL_CLIENT_STORAGE_BIT);
+			mapped = (unsigned char*)glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, capacity, flags);
+		}
+		if (mapped == NULL) {
+			glBufferData(GL_COPY_WRITE_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+			staging.resize(capacity);
+		}
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	~StagingRing() {
+		for (Region &region : regions) {
+			if (region.fence != NULL) glDeleteSync(region.fence);
+		}
+		if (mapped != NULL) {
+			glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+			glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+			glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &ID);
+	}
+
+	bool isPersistent() {
+		return mapped != NULL;
+	}
+
+	//Any thread. If the ring is full, either waits for the render thread to reclaim
+	//space or returns an invalid allocation. Sizes above the capacity never fit.
+	Allocation allocate(size_t size, bool wait = false) {
+		Allocation allocation;
+		size_t aligned = (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+		if (aligned == 0 || aligned > capacity) return allocation;
+
+		unique_lock<mutex> lock(guard);
+		size_t offset;
+		while (!place(aligned, offset)) {
+			if (!wait) return allocation;
+			reclaimed.wait(lock);
+		}
+
+		Region region;
+		region.offset = offset;
+		region.size = aligned;
+		region.id = nextId++;
+		regions.push_back(region);
+
+		allocation.data = (mapped != NULL ? mapped : staging.data()) + offset;
+		allocation.offset = offset;
+		allocation.size = size;
+		allocation.id = region.id;
+		return allocation;
+	}
+
+	//Render thread. Make the contents visible to GL before reading from the buffer.
+	void flush(const Allocation &allocation) {
+		if (mapped != NULL || !allocation.isValid()) return;
+		glBindBuffer(GL_COPY_WRITE_BUFFER, ID);
+		glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.offset, allocation.size, allocation.data);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	//Render thread. Upload into a buffer object, e.g. vertices written by a worker.
+	void copy(const Allocation &allocation, unsigned int buffer, GLintptr offset) {
+		flush(allocation);
+		glBindBuffer(GL_COPY_READ_BUFFER, ID);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, allocation.offset, offset, allocation.size);
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	}
+
+	//Render thread. Every command reading the allocation has been issued.
+	void submit(const Allocation &allocation) {
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		lock_guard<mutex> lock(guard);
+		Region* region = find(allocation.id);
+		if (region != NULL) {
+			region->fence = fence;
+			region->done = true;
+		}
+		else glDeleteSync(fence);
+	}
+
+	//Any thread. The allocation was not used.
+	void release(const Allocation &allocation) {
+		lock_guard<mutex> lock(guard);
+		Region* region = find(allocation.id);
+		if (region != NULL) region->done = true;
+	}
+
+	//Free regions the GPU has finished reading, oldest first. With wait, blocks until
+	//every submitted region is free. Fences are only tested, so this never blocks otherwise.
+	void reclaim(bool wait = false) {
+		bool freed = false;
+		{
+			lock_guard<mutex> lock(guard);
+			while (!regions.empty() && regions.front().done) {
+				Region &region = regions.front();
+				if (region.fence != NULL) {
+					GLenum status = glClientWaitSync(region.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+					if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) break;
+					glDeleteSync(region.fence);
+				}
+				regions.pop_front();
+				freed = true;
+			}
+		}
+		if (freed) reclaimed.notify_all();
+	}
+
+	//Bytes held by regions not reclaimed yet
+	size_t bytesInUse() {
+		lock_guard<mutex> lock(guard);
+		if (regions.empty()) return 0;
+		size_t head = regions.back().offset + regions.back().size;
+		size_t tail = regions.front().offset;
+		return head > tail ? head - tail : capacity - tail + head;
+	}
+
+private:
+	struct Region {
+		size_t offset;
+		size_t size;
+		unsigned long long id;
+		GLsync fence = NULL;
+		bool done = false;	//Submitted or released
+	};
+
+	size_t capacity;
+	unsigned char* mapped = NULL;
+	vector<unsigned char> staging;
+	deque<Region> regions;		//Oldest first
+	unsigned long long nextId = 1;
+	mutex guard;
+	condition_variable reclaimed;
+
+	//Find room after the newest region, wrapping to the start when the end is too short
+	bool place(size_t size, size_t &offset) {
+		if (regions.empty()) {
+			offset = 0;
+			return true;
+		}
+
+		size_t head = regions.back().offset + regions.back().size;
+		size_t tail = regions.front().offset;
+		bool wrapped = regions.back().offset < tail;
+		if (!wrapped && head + size <= capacity) offset = head;
+		else if (!wrapped && size <= tail) offset = 0;
+		else if (wrapped && head + size <= tail) offset = head;
+		else return false;
+		return true;
+	}
+
+	Region* find(unsigned long long id) {
+		if (regions.empty() || id < regions.front().id) return NULL;
+		size_t index = (size_t)(id - regions.front().id);
+		return index < regions.size() ? &regions[index] : NULL;
+	}
+};
+
+#endif
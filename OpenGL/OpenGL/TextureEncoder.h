@@ -0,0 +1,561 @@
+#ifndef TEXTURE_ENCODER_H
+#define TEXTURE_ENCODER_H
+
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include <cfloat>
+#include "TextureFile.h"
+#include "ThreadPool.h"
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TEXTURE_ENCODER_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+//Encodes RGBA8 images into the block formats of TextureFile, offline or on loader threads.
+//
+//Each 4x4 block gets candidate endpoints, from the bounding box of its pixels or from their
+//principal axis, refined by least squares. Every candidate is scored by quantizing it the
+//way the GPU will and picking the closest palette entry for each pixel; that search is the
+//hot loop and runs four pixels at a time with SSE2. Pixel and palette values are whole
+//numbers, so the SSE2 and scalar paths pick the same indices and produce identical files.
+//
+//BC7 is written in mode 6 only: one subset, RGBA endpoints with 4 bit indices. ETC2 is not
+//encoded.
+class TextureEncoder {
+public:
+	enum Quality {
+		FAST,	//Bounding box endpoints
+		NORMAL,	//Principal axis endpoints, refined once
+		HIGH	//Refined until it stops improving, and a wider search for BC4 and BC7
+	};
+
+	static bool canEncode(TextureFile::Format format) {
+		return format < TextureFile::ETC2_RGB;
+	}
+
+	//Encode one mip level. Block rows are split across pool when one is given; this may be
+	//called from a task of that pool. error receives the mean squared error per channel
+	//the format stores, over whole blocks including the repeated edge pixels. Returns false
+	//for formats canEncode() rejects.
+	static bool encode(TextureFile::Format format, const unsigned char* rgba, int width, int height, vector<unsigned char> &out, Quality quality = NORMAL, ThreadPool* pool = NULL, double* error = NULL) {
+		if (!canEncode(format)) return false;
+		out.resize(TextureFile::levelSize(format, width, height));
+		if (format == TextureFile::RGBA8) {
+			memcpy(out.data(), rgba, out.size());
+			if (error != NULL) *error = 0;
+			return true;
+		}
+
+		int blocksWide = (width + 3) / 4;
+		int blocksHigh = (height + 3) / 4;
+		size_t rowBytes = (size_t)blocksWide * TextureFile::blockBytes(format);
+		vector<double> errors(blocksHigh);
+		function<void(int)> encodeRow = [&](int row) {
+			unsigned char* block = out.data() + row * rowBytes;
+			double sum = 0;
+			for (int x = 0;x < blocksWide;x++) {
+				Block pixels;
+				fetch(rgba, width, height, x * 4, row * 4, pixels);
+				sum += encodeBlock(format, pixels, quality, block);
+				block += TextureFile::blockBytes(format);
+			}
+			errors[row] = sum;
+		};
+		if (pool != NULL) pool->parallelFor(blocksHigh, encodeRow);
+		else for (int row = 0;row < blocksHigh;row++) encodeRow(row);
+
+		if (error != NULL) {
+			double sum = 0;
+			for (double rowError : errors) sum += rowError;
+			*error = sum / ((double)blocksWide * blocksHigh * 16 * channelsOf(format));
+		}
+		return true;
+	}
+
+	//Encode every level of a chain, such as one from MipBuilder::build(), into levels[i]
+	static bool encodeChain(TextureFile::Format format, const vector<vector<unsigned char>> &mips, int width, int height, vector<vector<unsigned char>> &levels, Quality quality = NORMAL, ThreadPool* pool = NULL) {
+		if (!canEncode(format)) return false;
+		levels.resize(mips.size());
+		for (int level = 0;level < (int)mips.size();level++) {
+			encode(format, mips[level].data(), TextureFile::mipSize(width, level), TextureFile::mipSize(height, level), levels[level], quality, pool);
+		}
+		return true;
+	}
+
+	//Turn the SSE2 search off or back on, to compare them. Not while encoding.
+	static void setSimd(bool enabled) {
+		simd() = enabled;
+	}
+	//Whether SSE2 is compiled in and on
+	static bool isSimd() {
+#ifdef TEXTURE_ENCODER_SSE2
+		return simd();
+#else
+		return false;
+#endif
+	}
+
+	static const char* qualityName(Quality quality) {
+		static const char* names[] = { "fast", "normal", "high" };
+		return names[quality];
+	}
+
+	//Returns false for an unknown name
+	static bool parseQuality(string name, Quality &quality) {
+		for (int i = FAST;i <= HIGH;i++) {
+			if (name == qualityName((Quality)i)) {
+				quality = (Quality)i;
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//Channels the format stores
+	static int channelsOf(TextureFile::Format format) {
+		switch (format) {
+		case TextureFile::BC1: case TextureFile::ETC2_RGB: return 3;
+		case TextureFile::BC4: return 1;
+		case TextureFile::BC5: return 2;
+		default: return 4;
+		}
+	}
+
+private:
+	//16 pixels, one row of floats per channel
+	struct Block {
+		alignas(16) float values[4][16];
+	};
+
+	//Up to 16 palette colors, as the GPU decodes them
+	typedef float Palette[16][4];
+
+	static bool& simd() {
+		static bool enabled = true;
+		return enabled;
+	}
+
+	//4x4 pixels at x, y. Blocks hanging over the edge repeat the last row and column.
+	static void fetch(const unsigned char* rgba, int width, int height, int x, int y, Block &block) {
+		for (int j = 0;j < 4;j++) {
+			int row = y + j < height ? y + j : height - 1;
+			for (int i = 0;i < 4;i++) {
+				int column = x + i < width ? x + i : width - 1;
+				const unsigned char* pixel = rgba + ((size_t)row * width + column) * 4;
+				for (int c = 0;c < 4;c++) block.values[c][j * 4 + i] = pixel[c];
+			}
+		}
+	}
+
+	static float encodeBlock(TextureFile::Format format, const Block &block, Quality quality, unsigned char* out) {
+		switch (format) {
+		case TextureFile::BC1: return encodeColor(block, quality, out);
+		case TextureFile::BC3: return encodeSingle(block, 3, quality, out) + encodeColor(block, quality, out + 8);
+		case TextureFile::BC4: return encodeSingle(block, 0, quality, out);
+		case TextureFile::BC5: return encodeSingle(block, 0, quality, out) + encodeSingle(block, 1, quality, out + 8);
+		default: return encodeMode6(block, quality, out);
+		}
+	}
+
+	//Closest of count palette entries for every pixel, comparing channels first to
+	//first + channels. Returns the summed squared error.
+	static float selectIndices(const Block &block, int first, int channels, const Palette &palette, int count, unsigned char* indices) {
+#ifdef TEXTURE_ENCODER_SSE2
+		if (simd()) {
+			__m128 total = _mm_setzero_ps();
+			for (int i = 0;i < 16;i += 4) {
+				__m128 best = _mm_set1_ps(FLT_MAX);
+				__m128i bestIndex = _mm_setzero_si128();
+				for (int k = 0;k < count;k++) {
+					__m128 error = _mm_setzero_ps();
+					for (int c = first;c < first + channels;c++) {
+						__m128 difference = _mm_sub_ps(_mm_load_ps(block.values[c] + i), _mm_set1_ps(palette[k][c]));
+						error = _mm_add_ps(error, _mm_mul_ps(difference, difference));
+					}
+					__m128i closer = _mm_castps_si128(_mm_cmplt_ps(error, best));
+					best = _mm_min_ps(error, best);
+					bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(k)), _mm_andnot_si128(closer, bestIndex));
+				}
+				total = _mm_add_ps(total, best);
+				alignas(16) int chosen[4];
+				_mm_store_si128((__m128i*)chosen, bestIndex);
+				for (int j = 0;j < 4;j++) indices[i + j] = (unsigned char)chosen[j];
+			}
+			alignas(16) float sums[4];
+			_mm_store_ps(sums, total);
+			return sums[0] + sums[1] + sums[2] + sums[3];
+		}
+#endif
+		float total = 0;
+		for (int i = 0;i < 16;i++) {
+			float best = FLT_MAX;
+			int bestIndex = 0;
+			for (int k = 0;k < count;k++) {
+				float error = 0;
+				for (int c = first;c < first + channels;c++) {
+					float difference = block.values[c][i] - palette[k][c];
+					error += difference * difference;
+				}
+				if (error < best) {
+					best = error;
+					bestIndex = k;
+				}
+			}
+			total += best;
+			indices[i] = (unsigned char)bestIndex;
+		}
+		return total;
+	}
+
+	static void boundingBox(const Block &block, int first, int channels, float* low, float* high) {
+		for (int c = first;c < first + channels;c++) {
+			low[c] = 255;
+			high[c] = 0;
+			for (int i = 0;i < 16;i++) {
+				if (block.values[c][i] < low[c]) low[c] = block.values[c][i];
+				if (block.values[c][i] > high[c]) high[c] = block.values[c][i];
+			}
+		}
+	}
+
+	//Ends of the line through the pixels along their direction of greatest variance.
+	//Falls back to the bounding box when the block is flat.
+	static void principalAxis(const Block &block, int channels, float* low, float* high) {
+		float mean[4] = {};
+		for (int c = 0;c < channels;c++) {
+			for (int i = 0;i < 16;i++) mean[c] += block.values[c][i];
+			mean[c] /= 16;
+		}
+		float covariance[4][4] = {};
+		for (int i = 0;i < 16;i++) {
+			for (int a = 0;a < channels;a++) {
+				for (int b = a;b < channels;b++) covariance[a][b] += (block.values[a][i] - mean[a]) * (block.values[b][i] - mean[b]);
+			}
+		}
+		for (int a = 0;a < channels;a++) {
+			for (int b = 0;b < a;b++) covariance[a][b] = covariance[b][a];
+		}
+
+		//Power iteration
+		float axis[4] = { 1, 1, 1, 1 };
+		for (int iteration = 0;iteration < 8;iteration++) {
+			float next[4] = {};
+			float length = 0;
+			for (int a = 0;a < channels;a++) {
+				for (int b = 0;b < channels;b++) next[a] += covariance[a][b] * axis[b];
+				length = fmaxf(length, fabsf(next[a]));
+			}
+			if (length < 1e-6f) {
+				boundingBox(block, 0, channels, low, high);
+				return;
+			}
+			for (int a = 0;a < channels;a++) axis[a] = next[a] / length;
+		}
+
+		float length = 0;
+		for (int c = 0;c < channels;c++) length += axis[c] * axis[c];
+		float minimum = FLT_MAX, maximum = -FLT_MAX;
+		for (int i = 0;i < 16;i++) {
+			float t = 0;
+			for (int c = 0;c < channels;c++) t += (block.values[c][i] - mean[c]) * axis[c];
+			minimum = fminf(minimum, t);
+			maximum = fmaxf(maximum, t);
+		}
+		for (int c = 0;c < channels;c++) {
+			low[c] = clamp(mean[c] + axis[c] * minimum / length, 0, 255);
+			high[c] = clamp(mean[c] + axis[c] * maximum / length, 0, 255);
+		}
+	}
+
+	//Endpoints a and b minimizing the squared error for fixed indices, where weights[k] is
+	//how far palette entry k lies from a towards b. False when every pixel has the same weight.
+	static bool leastSquares(const Block &block, int first, int channels, const unsigned char* indices, const float* weights, float* a, float* b) {
+		float aa = 0, ab = 0, bb = 0;
+		float xa[4] = {}, xb[4] = {};
+		for (int i = 0;i < 16;i++) {
+			float t = weights[indices[i]];
+			aa += (1 - t) * (1 - t);
+			ab += (1 - t) * t;
+			bb += t * t;
+			for (int c = first;c < first + channels;c++) {
+				xa[c] += (1 - t) * block.values[c][i];
+				xb[c] += t * block.values[c][i];
+			}
+		}
+		float determinant = aa * bb - ab * ab;
+		if (fabsf(determinant) < 1e-6f) return false;
+		for (int c = first;c < first + channels;c++) {
+			a[c] = clamp((xa[c] * bb - xb[c] * ab) / determinant, 0, 255);
+			b[c] = clamp((xb[c] * aa - xa[c] * ab) / determinant, 0, 255);
+		}
+		return true;
+	}
+
+	static float clamp(float value, float low, float high) {
+		return value < low ? low : value > high ? high : value;
+	}
+
+	static int round(float value, int maximum) {
+		int rounded = (int)(value + 0.5f);
+		return rounded < 0 ? 0 : rounded > maximum ? maximum : rounded;
+	}
+
+	//BC1
+	struct ColorBlock {
+		int color0;
+		int color1;
+		unsigned char indices[16];
+		float error = FLT_MAX;
+	};
+
+	static int to565(const float* rgb) {
+		return round(rgb[0] * 31 / 255, 31) << 11 | round(rgb[1] * 63 / 255, 63) << 5 | round(rgb[2] * 31 / 255, 31);
+	}
+
+	static void from565(int color, float* rgb) {
+		int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+		rgb[0] = (float)(r << 3 | r >> 2);
+		rgb[1] = (float)(g << 2 | g >> 4);
+		rgb[2] = (float)(b << 3 | b >> 2);
+	}
+
+	//Score endpoints in the four color mode and keep them if they beat best
+	static void tryColor(const Block &block, int color0, int color1, ColorBlock &best) {
+		ColorBlock candidate;
+		candidate.color0 = color0 > color1 ? color0 : color1;
+		candidate.color1 = color0 > color1 ? color1 : color0;
+
+		Palette palette;
+		from565(candidate.color0, palette[0]);
+		from565(candidate.color1, palette[1]);
+		for (int c = 0;c < 3;c++) {
+			palette[2][c] = (float)(((int)palette[0][c] * 2 + (int)palette[1][c]) / 3);
+			palette[3][c] = (float)(((int)palette[0][c] + (int)palette[1][c] * 2) / 3);
+		}
+		//Equal endpoints would select the three color mode, where index 3 is black
+		candidate.error = selectIndices(block, 0, 3, palette, color0 == color1 ? 1 : 4, candidate.indices);
+		if (candidate.error < best.error) best = candidate;
+	}
+
+	static float encodeColor(const Block &block, Quality quality, unsigned char* out) {
+		static const float weights[4] = { 0, 1, 1 / 3.0f, 2 / 3.0f };
+		float low[4], high[4];
+		ColorBlock best;
+		boundingBox(block, 0, 3, low, high);
+		tryColor(block, to565(high), to565(low), best);
+		if (quality >= NORMAL) {
+			principalAxis(block, 3, low, high);
+			tryColor(block, to565(high), to565(low), best);
+		}
+
+		int refinements = quality == HIGH ? 8 : quality == NORMAL ? 1 : 0;
+		for (int i = 0;i < refinements && best.color0 != best.color1;i++) {
+			float previous = best.error;
+			if (!leastSquares(block, 0, 3, best.indices, weights, high, low)) break;
+			tryColor(block, to565(high), to565(low), best);
+			if (best.error >= previous) break;
+		}
+
+		unsigned int indices = 0;
+		for (int i = 0;i < 16;i++) indices |= (unsigned int)best.indices[i] << (i * 2);
+		out[0] = best.color0 & 255;
+		out[1] = best.color0 >> 8;
+		out[2] = best.color1 & 255;
+		out[3] = best.color1 >> 8;
+		for (int i = 0;i < 4;i++) out[4 + i] = indices >> (i * 8) & 255;
+		return best.error;
+	}
+
+	//BC4, and the alpha of BC3 and both halves of BC5
+	struct SingleBlock {
+		int value0;
+		int value1;
+		unsigned char indices[16];
+		float error = FLT_MAX;
+	};
+
+	//value0 > value1 selects eight interpolated values, otherwise six plus 0 and 255
+	static void trySingle(const Block &block, int channel, int value0, int value1, SingleBlock &best) {
+		SingleBlock candidate;
+		candidate.value0 = value0;
+		candidate.value1 = value1;
+
+		Palette palette;
+		palette[0][channel] = (float)value0;
+		palette[1][channel] = (float)value1;
+		if (value0 > value1) {
+			for (int i = 1;i < 7;i++) palette[i + 1][channel] = (float)(((7 - i) * value0 + i * value1) / 7);
+		}
+		else {
+			for (int i = 1;i < 5;i++) palette[i + 1][channel] = (float)(((5 - i) * value0 + i * value1) / 5);
+			palette[6][channel] = 0;
+			palette[7][channel] = 255;
+		}
+		candidate.error = selectIndices(block, channel, 1, palette, 8, candidate.indices);
+		if (candidate.error < best.error) best = candidate;
+	}
+
+	static float encodeSingle(const Block &block, int channel, Quality quality, unsigned char* out) {
+		static const float weights[8] = { 0, 1, 1 / 7.0f, 2 / 7.0f, 3 / 7.0f, 4 / 7.0f, 5 / 7.0f, 6 / 7.0f };
+		float low[4], high[4];
+		boundingBox(block, channel, 1, low, high);
+		int minimum = (int)low[channel], maximum = (int)high[channel];
+
+		SingleBlock best;
+		trySingle(block, channel, maximum, minimum, best);
+		if (quality == HIGH) {
+			//Pull the ends in a little, and try the six value mode on the values between 0 and 255
+			for (int inner = 0;inner < 4;inner++) {
+				for (int outer = 0;outer < 4;outer++) {
+					if (maximum - outer > minimum + inner) trySingle(block, channel, maximum - outer, minimum + inner, best);
+				}
+			}
+			int middleLow = 255, middleHigh = 0;
+			for (int i = 0;i < 16;i++) {
+				int value = (int)block.values[channel][i];
+				if (value > 0 && value < middleLow) middleLow = value;
+				if (value < 255 && value > middleHigh) middleHigh = value;
+			}
+			if (middleLow <= middleHigh) trySingle(block, channel, middleLow, middleHigh, best);
+		}
+
+		int refinements = quality == HIGH ? 8 : quality == NORMAL ? 1 : 0;
+		for (int i = 0;i < refinements && best.value0 > best.value1;i++) {
+			float previous = best.error;
+			if (!leastSquares(block, channel, 1, best.indices, weights, high, low)) break;
+			int value0 = round(high[channel], 255), value1 = round(low[channel], 255);
+			if (value0 < value1) {
+				int swap = value0;
+				value0 = value1;
+				value1 = swap;
+			}
+			if (value0 == value1) break;
+			trySingle(block, channel, value0, value1, best);
+			if (best.error >= previous) break;
+		}
+
+		unsigned long long indices = 0;
+		for (int i = 0;i < 16;i++) indices |= (unsigned long long)best.indices[i] << (i * 3);
+		out[0] = (unsigned char)best.value0;
+		out[1] = (unsigned char)best.value1;
+		for (int i = 0;i < 6;i++) out[2 + i] = indices >> (i * 8) & 255;
+		return best.error;
+	}
+
+	//BC7 mode 6
+	struct Mode6Block {
+		int endpoints[2][4];	//7 bits
+		int pBits[2];
+		unsigned char indices[16];
+		float error = FLT_MAX;
+	};
+
+	//Endpoint with 7 bit channels and a shared lowest bit
+	static void quantize(const float* color, int pBit, int* endpoint) {
+		for (int c = 0;c < 4;c++) endpoint[c] = round((color[c] - pBit) / 2, 127);
+	}
+
+	//Shared bit that quantizes color closest
+	static int bestPBit(const float* color) {
+		float errors[2] = {};
+		for (int pBit = 0;pBit < 2;pBit++) {
+			int endpoint[4];
+			quantize(color, pBit, endpoint);
+			for (int c = 0;c < 4;c++) errors[pBit] += fabsf(endpoint[c] * 2 + pBit - color[c]);
+		}
+		return errors[1] < errors[0] ? 1 : 0;
+	}
+
+	//Interpolation weights of the 4 bit indices, out of 64
+	static const int* mode6Weights() {
+		static const int weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+		return weights;
+	}
+
+	static void tryMode6(const Block &block, const float* color0, const float* color1, int pBit0, int pBit1, Mode6Block &best) {
+		const int* weights = mode6Weights();
+		Mode6Block candidate;
+		candidate.pBits[0] = pBit0;
+		candidate.pBits[1] = pBit1;
+		quantize(color0, pBit0, candidate.endpoints[0]);
+		quantize(color1, pBit1, candidate.endpoints[1]);
+
+		Palette palette;
+		for (int c = 0;c < 4;c++) {
+			int value0 = candidate.endpoints[0][c] * 2 + pBit0;
+			int value1 = candidate.endpoints[1][c] * 2 + pBit1;
+			for (int k = 0;k < 16;k++) palette[k][c] = (float)(((64 - weights[k]) * value0 + weights[k] * value1 + 32) >> 6);
+		}
+		candidate.error = selectIndices(block, 0, 4, palette, 16, candidate.indices);
+		if (candidate.error < best.error) best = candidate;
+	}
+
+	//Either every shared bit combination or the closest bits
+	static void tryMode6(const Block &block, const float* color0, const float* color1, Quality quality, Mode6Block &best) {
+		if (quality == HIGH) {
+			for (int pBits = 0;pBits < 4;pBits++) tryMode6(block, color0, color1, pBits & 1, pBits >> 1, best);
+		}
+		else tryMode6(block, color0, color1, bestPBit(color0), bestPBit(color1), best);
+	}
+
+	static float encodeMode6(const Block &block, Quality quality, unsigned char* out) {
+		float weights[16];
+		for (int k = 0;k < 16;k++) weights[k] = mode6Weights()[k] / 64.0f;
+
+		float low[4], high[4];
+		Mode6Block best;
+		if (quality == FAST) boundingBox(block, 0, 4, low, high);
+		else principalAxis(block, 4, low, high);
+		tryMode6(block, low, high, quality, best);
+		if (quality == HIGH) {
+			boundingBox(block, 0, 4, low, high);
+			tryMode6(block, low, high, quality, best);
+		}
+
+		int refinements = quality == HIGH ? 8 : quality == NORMAL ? 1 : 0;
+		for (int i = 0;i < refinements;i++) {
+			float previous = best.error;
+			if (!leastSquares(block, 0, 4, best.indices, weights, low, high)) break;
+			tryMode6(block, low, high, quality, best);
+			if (best.error >= previous) break;
+		}
+
+		//The first index is stored without its top bit, so it has to be below 8
+		if (best.indices[0] >= 8) {
+			for (int c = 0;c < 4;c++) {
+				int swap = best.endpoints[0][c];
+				best.endpoints[0][c] = best.endpoints[1][c];
+				best.endpoints[1][c] = swap;
+			}
+			int swap = best.pBits[0];
+			best.pBits[0] = best.pBits[1];
+			best.pBits[1] = swap;
+			for (int i = 0;i < 16;i++) best.indices[i] = 15 - best.indices[i];
+		}
+
+		unsigned long long bits[2] = {};
+		int position = 0;
+		writeBits(bits, position, 1 << 6, 7);
+		for (int c = 0;c < 4;c++) {
+			writeBits(bits, position, best.endpoints[0][c], 7);
+			writeBits(bits, position, best.endpoints[1][c], 7);
+		}
+		writeBits(bits, position, best.pBits[0], 1);
+		writeBits(bits, position, best.pBits[1], 1);
+		writeBits(bits, position, best.indices[0], 3);
+		for (int i = 1;i < 16;i++) writeBits(bits, position, best.indices[i], 4);
+		for (int i = 0;i < 16;i++) out[i] = bits[i / 8] >> (i % 8 * 8) & 255;
+		return best.error;
+	}
+
+	static void writeBits(unsigned long long* bits, int &position, unsigned int value, int count) {
+		for (int i = 0;i < count;i++, position++) {
+			if (value >> i & 1) bits[position / 64] |= 1ULL << (position % 64);
+		}
+	}
+};
+
+#endif
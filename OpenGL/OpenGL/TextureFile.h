@@ -0,0 +1,303 @@
+#ifndef TEXTURE_FILE_H
+#define TEXTURE_FILE_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <cstring>
+#include <cstdint>
+#include <utility>
+#include <glad/glad.h>
+#include "GLExtensions.h"
+#include "MappedFile.h"
+
+using namespace std;
+
+//Texture container holding a whole mip chain in a GPU format, modeled on KTX2.
+//Files are written offline (see --convert in main.cpp) and read through a memory mapping,
+//so loading one costs no decoding and no copies: each level goes from the mapping straight
+//to glCompressedTexImage2D.
+//
+//Layout, little endian:
+//	Header		identifier, format, size and level count
+//	Index		offset and size of every level, level 0 first
+//	Levels		smallest level first, each aligned to ALIGNMENT bytes
+//Storing the small levels first lets a loader show them while the rest is still read in.
+class TextureFile {
+public:
+	enum Format {
+		RGBA8,		//Uncompressed
+		BC1,		//RGB, 8 bytes per 4x4 block
+		BC3,		//RGBA, 16 bytes per block
+		BC4,		//R, 8 bytes per block
+		BC5,		//RG, 16 bytes per block
+		BC7,		//RGBA, 16 bytes per block
+		ETC2_RGB,	//8 bytes per block
+		ETC2_RGBA,	//16 bytes per block
+		FORMATS
+	};
+
+	struct Level {
+		int width;
+		int height;
+		const unsigned char* data;
+		size_t size;
+	};
+
+	static const uint32_t VERSION = 1;
+	static const size_t ALIGNMENT = 16;
+
+	Format format = RGBA8;
+	bool srgb = false;
+	int width = 0;
+	int height = 0;
+	vector<Level> levels;
+	string error;
+
+	//Map a file and check it. Levels point into the mapping, which lives as long as this.
+	bool open(string path) {
+		if (!file.open(path)) {
+			error = "can't read file";
+			return false;
+		}
+		return parse(file.data, file.size);
+	}
+
+	//Take levels encoded in memory, as from TextureEncoder::encodeChain(), instead of a file
+	void create(Format format, bool srgb, int width, int height, vector<vector<unsigned char>> &&levels) {
+		this->format = format;
+		this->srgb = srgb;
+		this->width = width;
+		this->height = height;
+		storage = move(levels);
+		this->levels.clear();
+		for (int i = 0;i < (int)storage.size();i++) {
+			Level level;
+			level.width = mipSize(width, i);
+			level.height = mipSize(height, i);
+			level.data = storage[i].data();
+			level.size = storage[i].size();
+			this->levels.push_back(level);
+		}
+	}
+
+	//Check a container already in memory. Levels point into data.
+	bool parse(const unsigned char* data, size_t size) {
+		levels.clear();
+		if (!isContainer(data, size) || size < sizeof(Header)) return fail("not a texture file");
+
+		Header header;
+		memcpy(&header, data, sizeof(header));
+		if (header.version != VERSION) return fail("unsupported version");
+		if (header.format >= FORMATS) return fail("unknown format");
+		if (header.width == 0 || header.height == 0 || header.width > MAX_SIZE || header.height > MAX_SIZE) return fail("bad size");
+		if (header.levels == 0 || header.levels > (uint32_t)levelCount(header.width, header.height)) return fail("bad level count");
+
+		format = (Format)header.format;
+		srgb = (header.flags & SRGB) != 0;
+		width = header.width;
+		height = header.height;
+
+		size_t indexEnd = sizeof(Header) + header.levels * sizeof(Entry);
+		if (size < indexEnd) return fail("truncated index");
+		for (uint32_t i = 0;i < header.levels;i++) {
+			Entry entry;
+			memcpy(&entry, data + sizeof(Header) + i * sizeof(Entry), sizeof(entry));
+
+			Level level;
+			level.width = mipSize(width, i);
+			level.height = mipSize(height, i);
+			level.size = levelSize(format, level.width, level.height);
+			if (entry.size != level.size || entry.offset < indexEnd || entry.offset > size || size - entry.offset < entry.size) return fail("bad level " + to_string(i));
+			level.data = data + entry.offset;
+			levels.push_back(level);
+		}
+		return true;
+	}
+
+	//Read the whole mapping in on the calling thread, see MappedFile::prefetch()
+	void prefetch() const {
+		file.prefetch();
+	}
+
+	static bool isContainer(const unsigned char* data, size_t size) {
+		return size >= IDENTIFIER_SIZE && memcmp(data, identifier(), IDENTIFIER_SIZE) == 0;
+	}
+
+	//levels[i] holds level i, as returned by encode() in TextureEncoder.h
+	static bool write(string path, Format format, bool srgb, int width, int height, const vector<vector<unsigned char>> &levels) {
+		if (levels.empty() || width <= 0 || height <= 0 || (int)levels.size() > levelCount(width, height)) return false;
+
+		Header header;
+		memcpy(header.identifier, identifier(), IDENTIFIER_SIZE);
+		header.version = VERSION;
+		header.format = format;
+		header.flags = srgb ? SRGB : 0;
+		header.width = width;
+		header.height = height;
+		header.levels = (uint32_t)levels.size();
+
+		//Smallest level first
+		vector<Entry> index(levels.size());
+		uint64_t offset = sizeof(Header) + levels.size() * sizeof(Entry);
+		for (int i = (int)levels.size() - 1;i >= 0;i--) {
+			if (levels[i].size() != levelSize(format, mipSize(width, i), mipSize(height, i))) return false;
+			offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+			index[i].offset = offset;
+			index[i].size = levels[i].size();
+			offset += levels[i].size();
+		}
+
+		ofstream out(path, ios::binary);
+		if (!out) return false;
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)index.data(), index.size() * sizeof(Entry));
+		uint64_t position = sizeof(Header) + levels.size() * sizeof(Entry);
+		static const char padding[ALIGNMENT] = {};
+		for (int i = (int)levels.size() - 1;i >= 0;i--) {
+			out.write(padding, index[i].offset - position);
+			out.write((const char*)levels[i].data(), levels[i].size());
+			position = index[i].offset + index[i].size;
+		}
+		return (bool)out;
+	}
+
+	//Upload one level into the bound GL_TEXTURE_2D
+	void upload(int level) {
+		const Level &mip = levels[level];
+		if (format == RGBA8) glTexImage2D(GL_TEXTURE_2D, level, glFormat(format, srgb), mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, mip.data);
+		else glCompressedTexImage2D(GL_TEXTURE_2D, level, glFormat(format, srgb), mip.width, mip.height, 0, (GLsizei)mip.size, mip.data);
+	}
+
+	//Define a level of the bound GL_TEXTURE_2D without filling it, for uploadRows()
+	void allocate(int level) {
+		const Level &mip = levels[level];
+		if (format == RGBA8) glTexImage2D(GL_TEXTURE_2D, level, glFormat(format, srgb), mip.width, mip.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		else glCompressedTexImage2D(GL_TEXTURE_2D, level, glFormat(format, srgb), mip.width, mip.height, 0, (GLsizei)mip.size, NULL);
+	}
+
+	//Upload rows y to y + rows of an allocated level. Both are multiples of blockSize(),
+	//except that the band may end at the bottom of the level.
+	void uploadRows(int level, int y, int rows) {
+		const Level &mip = levels[level];
+		int block = blockSize(format);
+		size_t rowSize = levelSize(format, mip.width, 1);
+		const unsigned char* data = mip.data + y / block * rowSize;
+		if (format == RGBA8) glTexSubImage2D(GL_TEXTURE_2D, level, 0, y, mip.width, rows, GL_RGBA, GL_UNSIGNED_BYTE, data);
+		else glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, y, mip.width, rows, glFormat(format, srgb), (GLsizei)levelSize(format, mip.width, rows), data);
+	}
+
+	//Whether the driver can sample format. Needs GLExtensions to be loaded.
+	static bool isSupported(Format format, bool srgb) {
+		GLExtensions &extensions = GLExtensions::get();
+		switch (format) {
+		case RGBA8: return true;
+		case BC1: case BC3: return srgb ? extensions.s3tcSrgb : extensions.s3tc;
+		case BC4: case BC5: return !srgb;
+		case BC7: return extensions.bptc;
+		case ETC2_RGB: case ETC2_RGBA: return extensions.etc2;
+		default: return false;
+		}
+	}
+
+	static GLenum glFormat(Format format, bool srgb) {
+		switch (format) {
+		case RGBA8: return srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+		case BC1: return srgb ? GL_COMPRESSED_SRGB_S3TC_DXT1_EXT : GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+		case BC3: return srgb ? GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT : GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+		case BC4: return GL_COMPRESSED_RED_RGTC1;
+		case BC5: return GL_COMPRESSED_RG_RGTC2;
+		case BC7: return srgb ? GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM : GL_COMPRESSED_RGBA_BPTC_UNORM;
+		case ETC2_RGB: return srgb ? GL_COMPRESSED_SRGB8_ETC2 : GL_COMPRESSED_RGB8_ETC2;
+		case ETC2_RGBA: return srgb ? GL_COMPRESSED_SRGB8_ALPHA8_ETC2_EAC : GL_COMPRESSED_RGBA8_ETC2_EAC;
+		default: return GL_NONE;
+		}
+	}
+
+	//Bytes per 4x4 block, or per pixel for RGBA8
+	static int blockBytes(Format format) {
+		switch (format) {
+		case BC1: case BC4: case ETC2_RGB: return 8;
+		case RGBA8: return 4;
+		default: return 16;
+		}
+	}
+
+	static int blockSize(Format format) {
+		return format == RGBA8 ? 1 : 4;
+	}
+
+	static size_t levelSize(Format format, int width, int height) {
+		int block = blockSize(format);
+		return (size_t)((width + block - 1) / block) * ((height + block - 1) / block) * blockBytes(format);
+	}
+
+	static int mipSize(int size, int level) {
+		size >>= level;
+		return size > 0 ? size : 1;
+	}
+
+	//Levels of a full chain down to 1x1
+	static int levelCount(int width, int height) {
+		int count = 1;
+		while (width > 1 || height > 1) {
+			width >>= 1;
+			height >>= 1;
+			count++;
+		}
+		return count;
+	}
+
+	static const char* formatName(Format format) {
+		static const char* names[FORMATS] = { "rgba8", "bc1", "bc3", "bc4", "bc5", "bc7", "etc2", "etc2a" };
+		return format < FORMATS ? names[format] : "unknown";
+	}
+
+	//Returns FORMATS for an unknown name
+	static Format parseFormat(string name) {
+		for (int i = 0;i < FORMATS;i++) {
+			if (name == formatName((Format)i)) return (Format)i;
+		}
+		return FORMATS;
+	}
+
+private:
+	static const size_t IDENTIFIER_SIZE = 12;
+	static const uint32_t MAX_SIZE = 1 << 16;
+
+	enum Flags {
+		SRGB = 1
+	};
+
+	struct Header {
+		unsigned char identifier[IDENTIFIER_SIZE];
+		uint32_t version;
+		uint32_t format;
+		uint32_t flags;
+		uint32_t width;
+		uint32_t height;
+		uint32_t levels;
+		uint32_t reserved[3] = {};
+	};
+
+	struct Entry {
+		uint64_t offset;
+		uint64_t size;
+	};
+
+	MappedFile file;
+	vector<vector<unsigned char>> storage;	//Levels given to create()
+
+	static const unsigned char* identifier() {
+		static const unsigned char bytes[IDENTIFIER_SIZE] = { 0xAB, 'T', 'E', 'X', ' ', '1', 0xBB, '\r', '\n', 0x1A, '\n', 0 };
+		return bytes;
+	}
+
+	bool fail(string reason) {
+		error = reason;
+		levels.clear();
+		return false;
+	}
+};
+
+#endif
@@ -0,0 +1,542 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstring>
+#include <glad/glad.h>
+#include "ThreadPool.h"
+#include "StagingRing.h"
+#include "MappedFile.h"
+#include "TextureFile.h"
+#include "TextureEncoder.h"
+#include "MipBuilder.h"
+#include "stb_image.h"
+
+using namespace std;
+
+//Loads textures without blocking the render thread.
+//load() returns a texture name at once, holding a 1x1 placeholder. Images are decoded on
+//worker threads; update() then copies each decoded image into the texture a band of rows
+//at a time, so a frame never uploads more than its byte budget. The texture keeps showing
+//the placeholder from a small mip level until the last row is in, and its name stays the
+//same when the real image replaces the placeholder.
+//
+//With a StagingRing the workers decode straight into the ring and the render thread uploads
+//from there directly. Images that do not fit in the ring go through it a band at a time,
+//or straight from memory when it is full.
+//
+//Progressive JPEGs can show blurry previews while they decode, see setPreviews().
+//Large JPEGs are also split across threads once the application installs a pool with
+//stbi_set_parallel_for(); the hook is global, so the loader leaves it alone.
+//
+//Texture files (TextureFile.h) skip decoding. Their levels are uploaded from the file mapping,
+//smallest first, and each finished level becomes the base level, so the texture sharpens
+//as the frames go by. setMipBuilder() and setEncoding() turn other images into such levels
+//on the workers.
+//
+//Textures live until release(). TextureManager.h counts their users and fits them in a
+//memory budget.
+class TextureLoader {
+public:
+	enum State {
+		PENDING,	//Placeholder in use
+		READY,
+		FAILED		//Placeholder kept
+	};
+
+	static const size_t DEFAULT_BUDGET = 4 * 1024 * 1024;
+
+	//Restores the texture binding and unpack alignment changed while uploading.
+	//TextureManager uploads with it too.
+	struct Binding {
+		GLint texture;
+		GLint alignment;
+
+		Binding() {
+			glGetIntegerv(GL_TEXTURE_BINDING_2D, &texture);
+			glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		}
+		~Binding() {
+			glBindTexture(GL_TEXTURE_2D, texture);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+		}
+	};
+
+	TextureLoader(StagingRing* ring = NULL, int threads = 0) : pool(threads), ring(ring) {
+	}
+
+	~TextureLoader() {
+		pool.wait();
+		for (shared_ptr<Job> &job : uploading) discard(*job);
+		for (shared_ptr<Job> &job : decoded) discard(*job);
+		for (const pair<const unsigned int, Texture> &texture : textures) {
+			if (texture.second.released) glDeleteTextures(1, &texture.first);
+		}
+	}
+
+	//format is GL_RED, GL_RG, GL_RGB or GL_RGBA; the image is converted to it when decoded.
+	//Texture files keep the format they were written in.
+	unsigned int load(string path, GLenum format) {
+		shared_ptr<Job> job(new Job());
+		job->path = path;
+		job->format = format;
+		job->channels = channelsOf(format);
+
+		glGenTextures(1, &job->texture);
+		Binding binding;
+		glBindTexture(GL_TEXTURE_2D, job->texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		setPlaceholder(0, format);
+
+		textures[job->texture] = Texture();
+		pool.submit([this, job] { decode(job); });
+		return job->texture;
+	}
+
+	//Upload decoded images, at most budget bytes. Call once per frame on the render thread.
+	//Returns the bytes uploaded.
+	size_t update(size_t budget = DEFAULT_BUDGET) {
+		if (ring != NULL) ring->reclaim();
+		{
+			lock_guard<mutex> lock(guard);
+			uploading.insert(uploading.end(), decoded.begin(), decoded.end());
+			decoded.clear();
+		}
+		if (uploading.empty()) return 0;
+
+		Binding binding;
+		size_t uploaded = 0;
+		while (!uploading.empty() && uploaded < budget) {
+			shared_ptr<Job> job = uploading.front();
+			map<unsigned int, Texture>::iterator found = textures.find(job->texture);
+			if (found == textures.end()) {
+				discard(*job);
+				uploading.pop_front();
+				continue;
+			}
+			Texture &texture = found->second;
+			if (texture.released) {
+				cancel(*job);
+				uploading.pop_front();
+				continue;
+			}
+			if (job->failed) {
+				if (verbose) log("Cannot load " + job->path + ": " + job->error);
+				texture.state = FAILED;
+				uploading.pop_front();
+				continue;
+			}
+
+			glBindTexture(GL_TEXTURE_2D, job->texture);
+			if (job->file) {
+				uploaded += uploadLevel(*job, budget - uploaded);
+				if (job->level < 0) {
+					texture.state = READY;
+					for (const TextureFile::Level &level : job->file->levels) texture.size += level.size;
+					if (keepFiles) texture.file = job->file;
+					uploading.pop_front();
+				}
+				continue;
+			}
+
+			size_t rowSize = (size_t)job->width * job->channels;
+			if (job->rowsUploaded == 0) allocate(*job, texture);
+
+			//Band of rows that fits in what is left of the budget, at least one row
+			size_t rows = (budget - uploaded) / rowSize;
+			if (rows < 1) rows = 1;
+			if (rows > (size_t)(job->height - job->rowsUploaded)) rows = job->height - job->rowsUploaded;
+
+			uploadRows(*job, (int)rows);
+			job->rowsUploaded += (int)rows;
+			uploaded += rows * rowSize;
+
+			if (job->rowsUploaded == job->height) {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+				glGenerateMipmap(GL_TEXTURE_2D);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+				if (job->staging.isValid()) ring->submit(job->staging);
+				else freePixels(*job);
+				texture.width = job->width;
+				texture.height = job->height;
+				if (!job->isPreview) {
+					texture.state = READY;
+					texture.size = (size_t)job->width * job->height * job->channels * 4 / 3;
+				}
+				uploading.pop_front();
+			}
+		}
+		return uploaded;
+	}
+
+	//Wait for every decode and upload everything
+	void finish() {
+		pool.wait();
+		update((size_t)-1);
+	}
+
+	State getState(unsigned int texture) {
+		map<unsigned int, Texture>::iterator found = textures.find(texture);
+		return found != textures.end() && !found->second.released ? found->second.state : FAILED;
+	}
+	bool isReady(unsigned int texture) {
+		return getState(texture) == READY;
+	}
+
+	//Textures still showing their placeholder because they are decoding or uploading
+	int pending() {
+		int count = 0;
+		for (const pair<const unsigned int, Texture> &texture : textures) {
+			if (texture.second.state == PENDING && !texture.second.released) count++;
+		}
+		return count;
+	}
+
+	//Bytes of video memory a READY texture takes with all its levels, roughly for decoded images
+	size_t getSize(unsigned int texture) {
+		map<unsigned int, Texture>::iterator found = textures.find(texture);
+		return found != textures.end() ? found->second.size : 0;
+	}
+
+	//Texture file a READY texture was uploaded from, or built into on the workers, so its
+	//levels can be uploaded again. NULL for decoded images and unless setKeepFiles() is on.
+	shared_ptr<TextureFile> getFile(unsigned int texture) {
+		map<unsigned int, Texture>::iterator found = textures.find(texture);
+		return found != textures.end() ? found->second.file : shared_ptr<TextureFile>();
+	}
+
+	//Delete a texture and forget it. A texture still loading is deleted once its image is
+	//decoded, without being uploaded, so its name is not reused while a worker has it.
+	//Names that did not come from load() are just deleted.
+	void release(unsigned int texture) {
+		map<unsigned int, Texture>::iterator found = textures.find(texture);
+		if (found != textures.end() && found->second.state == PENDING) {
+			found->second.released = true;
+			return;
+		}
+		glDeleteTextures(1, &texture);
+		if (found != textures.end()) textures.erase(found);
+	}
+
+	//Keep the TextureFile of every texture uploaded from one, see getFile(). Files stay
+	//mapped, and images encoded on the workers stay in memory.
+	void setKeepFiles(bool keep) {
+		keepFiles = keep;
+	}
+
+	void setVerbose(int verbose) {
+		this->verbose = verbose;
+	}
+
+	//Upload up to count previews of each progressive JPEG, one after each of its first
+	//scans, before the finished image. Every preview is uploaded like a whole texture.
+	//0, the default, only shows the finished image. Call before load().
+	void setPreviews(int count) {
+		previews = count;
+	}
+
+	//Build the mip chains of decoded images on the workers with MipBuilder instead of with
+	//glGenerateMipmap, and upload them like texture files. sRGB settings also make the
+	//textures sRGB. Call before load().
+	void setMipBuilder(const MipBuilder::Settings &settings) {
+		buildMips = true;
+		mipSettings = settings;
+	}
+
+	//Compress decoded images and their mip chains (see setMipBuilder) into format on the
+	//workers, then upload them like texture files. For images that only exist at run time,
+	//such as user content. TextureFile::FORMATS, the default, uploads them as decoded.
+	//Formats the encoder cannot write or the driver cannot sample are ignored; sRGB is
+	//dropped where the driver lacks the sRGB variant. Call before load().
+	void setEncoding(TextureFile::Format format, TextureEncoder::Quality quality = TextureEncoder::FAST) {
+		if (format != TextureFile::FORMATS && (!TextureEncoder::canEncode(format) || !TextureFile::isSupported(format, false))) {
+			if (verbose) log(string("Cannot encode textures as ") + TextureFile::formatName(format));
+			return;
+		}
+		encoding = format;
+		encodingQuality = quality;
+	}
+
+private:
+	struct Job {
+		string path;
+		unsigned int texture = 0;
+		GLenum format;
+		int channels;
+		unsigned char* pixels = NULL;	//Decoded image until it is staged
+		vector<unsigned char> preview;	//Holds the pixels of a preview
+		StagingRing::Allocation staging;	//Decoded image, if it fit in the ring
+		bool failed = false;
+		int width = 0;
+		int height = 0;
+		string error;
+		int rowsUploaded = 0;
+		shared_ptr<TextureFile> file;	//Set for texture files
+		int level = -1;					//Level of the file being uploaded
+		bool isPreview = false;
+	};
+
+	struct Texture {
+		State state = PENDING;
+		size_t size = 0;			//Bytes with every level, once READY
+		shared_ptr<TextureFile> file;	//See setKeepFiles()
+		bool released = false;		//Delete once loaded
+		int width = 0;				//Of the decoded image or preview shown, 0 for the placeholder
+		int height = 0;
+	};
+
+	ThreadPool pool;
+	StagingRing* ring;
+	mutex guard;
+	deque<shared_ptr<Job>> decoded;		//Guarded, filled by the workers
+	deque<shared_ptr<Job>> uploading;	//Render thread only
+	map<unsigned int, Texture> textures;
+	int verbose = false;
+	int previews = 0;
+	TextureFile::Format encoding = TextureFile::FORMATS;
+	TextureEncoder::Quality encodingQuality = TextureEncoder::FAST;
+	bool buildMips = false;
+	MipBuilder::Settings mipSettings;
+	bool keepFiles = false;
+
+	void log(string message) {
+		cout << message << endl;
+	}
+
+	static int channelsOf(GLenum format) {
+		switch (format) {
+		case GL_RED: return 1;
+		case GL_RG: return 2;
+		case GL_RGB: return 3;
+		}
+		return 4;
+	}
+
+	static GLenum formatOf(int channels) {
+		static const GLenum formats[] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+		return formats[channels - 1];
+	}
+
+	//Render thread. Staging the GPU may still read rows from is fenced, not released.
+	void discard(Job &job) {
+		freePixels(job);
+		if (job.staging.isValid() && job.rowsUploaded > 0) ring->submit(job.staging);
+		else if (job.staging.isValid()) ring->release(job.staging);
+	}
+
+	//Drop a job of a released texture, deleting the texture after its last job
+	void cancel(Job &job) {
+		discard(job);
+		if (!job.isPreview) {
+			glDeleteTextures(1, &job.texture);
+			textures.erase(job.texture);
+		}
+	}
+
+	static void freePixels(Job &job) {
+		if (job.preview.empty()) stbi_image_free(job.pixels);
+		else vector<unsigned char>().swap(job.preview);
+		job.pixels = NULL;
+	}
+
+	struct Progress {
+		TextureLoader* loader;
+		shared_ptr<Job> job;
+		int count;
+	};
+
+	//Worker thread. Queue a copy of the image so far as an upload of its own.
+	static int onScan(void* user, int scans, const stbi_uc* pixels, int width, int height, int channels) {
+		(void)scans;
+		Progress* progress = (Progress*)user;
+		if (progress->count == progress->loader->previews) return 1;
+		progress->count++;
+
+		shared_ptr<Job> preview(new Job());
+		preview->path = progress->job->path;
+		preview->texture = progress->job->texture;
+		preview->isPreview = true;
+		preview->format = formatOf(channels);
+		preview->channels = channels;
+		preview->width = width;
+		preview->height = height;
+		preview->preview.assign(pixels, pixels + (size_t)width * height * channels);
+		preview->pixels = preview->preview.data();
+
+		lock_guard<mutex> lock(progress->loader->guard);
+		progress->loader->decoded.push_back(preview);
+		return 1;
+	}
+
+	//Worker thread. The file is mapped whole because stb_image only decodes JPEG restart
+	//intervals in parallel from memory. Previews need the whole image, so they skip the ring.
+	void decode(shared_ptr<Job> job) {
+		MappedFile file(job->path);
+		if (!file.isOpen()) {
+			job->failed = true;
+			job->error = "can't read file";
+		}
+		else if (TextureFile::isContainer(file.data, file.size)) {
+			open(*job);
+		}
+		else {
+			const stbi_uc* data = file.data;
+			int channels;
+			bool prepare = buildMips || encoding != TextureFile::FORMATS;
+			bool showScans = previews > 0 && stbi_is_progressive_from_memory(data, (int)file.size);
+			if (ring != NULL && !showScans && !prepare && stbi_info_from_memory(data, (int)file.size, &job->width, &job->height, &channels)) {
+				//Decode straight into the ring when the image fits. Never waits for space,
+				//the render thread may be waiting for this pool. Progressive JPEGs with
+				//previews are decoded to memory, the previews need the scans.
+				int stride = job->width * job->channels;
+				job->staging = ring->allocate((size_t)stride * job->height);
+				if (job->staging.isValid() && !stbi_load_into_from_memory(data, (int)file.size, job->staging.data, stride, job->height, &job->width, &job->height, &channels, job->channels)) {
+					ring->release(job->staging);
+					job->staging = StagingRing::Allocation();
+					job->failed = true;
+					job->error = stbi_failure_reason();
+				}
+			}
+			if (!job->failed && !job->staging.isValid()) {
+				Progress progress = { this, job, 0 };
+				int decodeChannels = prepare ? 4 : job->channels;
+				job->pixels = stbi_load_progressive_from_memory(data, (int)file.size, &job->width, &job->height, &channels, decodeChannels, showScans ? onScan : NULL, &progress);
+				if (job->pixels == NULL) {
+					job->failed = true;
+					job->error = stbi_failure_reason();
+				}
+				else if (prepare) compress(*job);
+			}
+		}
+
+		lock_guard<mutex> lock(guard);
+		decoded.push_back(job);
+	}
+
+	//Worker thread. Check a texture file and read it in, so the uploads do not wait for the disk.
+	void open(Job &job) {
+		job.file.reset(new TextureFile());
+		TextureFile &file = *job.file;
+		if (!file.open(job.path)) {
+			job.failed = true;
+			job.error = file.error;
+		}
+		else if (!TextureFile::isSupported(file.format, file.srgb)) {
+			job.failed = true;
+			job.error = string("format ") + TextureFile::formatName(file.format) + (file.srgb ? " srgb" : "") + " not supported by the driver";
+		}
+		else {
+			file.prefetch();
+			job.width = file.width;
+			job.height = file.height;
+			job.level = (int)file.levels.size() - 1;
+		}
+	}
+
+	//Worker thread. Build the mips of the decoded image and encode them, to be uploaded like
+	//a texture file.
+	void compress(Job &job) {
+		vector<vector<unsigned char>> mips, levels;
+		MipBuilder::build(job.pixels, job.width, job.height, mipSettings, mips, &pool);
+		stbi_image_free(job.pixels);
+		job.pixels = NULL;
+
+		TextureFile::Format format = encoding != TextureFile::FORMATS ? encoding : TextureFile::RGBA8;
+		if (format == TextureFile::RGBA8) levels.swap(mips);
+		else TextureEncoder::encodeChain(format, mips, job.width, job.height, levels, encodingQuality, &pool);
+		bool srgb = mipSettings.srgb && TextureFile::isSupported(format, true);
+		job.file.reset(new TextureFile());
+		job.file->create(format, srgb, job.width, job.height, move(levels));
+		job.level = (int)job.file->levels.size() - 1;
+	}
+
+	//Upload a band of block rows of the current level of a texture file, at least one.
+	//Returns the bytes uploaded.
+	size_t uploadLevel(Job &job, size_t budget) {
+		TextureFile &file = *job.file;
+		const TextureFile::Level &level = file.levels[job.level];
+		if (job.rowsUploaded == 0) {
+			//Until the first level is in, only the placeholder or preview at level 0 is sampled
+			if (job.level == (int)file.levels.size() - 1) {
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, job.level);
+			}
+			file.allocate(job.level);
+		}
+
+		int block = TextureFile::blockSize(file.format);
+		size_t bands = budget / TextureFile::levelSize(file.format, level.width, 1);
+		if (bands < 1) bands = 1;
+		int rows = level.height - job.rowsUploaded;
+		if (bands * block < (size_t)rows) rows = (int)bands * block;
+
+		file.uploadRows(job.level, job.rowsUploaded, rows);
+		job.rowsUploaded += rows;
+		if (job.rowsUploaded == level.height) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, job.level);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			job.level--;
+			job.rowsUploaded = 0;
+		}
+		return TextureFile::levelSize(file.format, level.width, rows);
+	}
+
+	static void setPlaceholder(int level, GLenum format) {
+		static const unsigned char placeholder[4] = { 128, 128, 128, 255 };
+		glTexImage2D(GL_TEXTURE_2D, level, format, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+	}
+
+	//Define level 0 at full size without showing it. Until the last row is in, the texture
+	//samples from level 1 the preview it already shows, or else the placeholder moved to the
+	//smallest level.
+	void allocate(Job &job, const Texture &texture) {
+		if (job.staging.isValid()) ring->flush(job.staging);
+		glTexImage2D(GL_TEXTURE_2D, 0, job.format, job.width, job.height, 0, job.format, GL_UNSIGNED_BYTE, NULL);
+
+		int last = TextureFile::levelCount(job.width, job.height) - 1;
+		if (last == 0) return;
+		if (texture.width == job.width && texture.height == job.height) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 1);
+		}
+		else {
+			setPlaceholder(last, job.format);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, last);
+		}
+	}
+
+	//Upload rows of the decoded image from the ring: in place when it was decoded there,
+	//else through a band of its own. Straight from memory when the ring has no room.
+	void uploadRows(Job &job, int rows) {
+		size_t rowSize = (size_t)job.width * job.channels;
+		size_t size = rows * rowSize;
+		StagingRing::Allocation band;
+		GLintptr offset;
+		if (job.staging.isValid()) offset = job.staging.offset + job.rowsUploaded * rowSize;
+		else if (ring != NULL && (band = ring->allocate(size)).isValid()) {
+			memcpy(band.data, job.pixels + job.rowsUploaded * rowSize, size);
+			ring->flush(band);
+			offset = band.offset;
+		}
+		else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.rowsUploaded, job.width, rows, job.format, GL_UNSIGNED_BYTE, job.pixels + job.rowsUploaded * rowSize);
+			return;
+		}
+
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, ring->ID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, job.rowsUploaded, job.width, rows, job.format, GL_UNSIGNED_BYTE, (const void*)offset);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		if (band.isValid()) ring->submit(band);
+	}
+};
+
+#endif
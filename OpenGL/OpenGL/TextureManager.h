@@ -0,0 +1,325 @@
+#ifndef TEXTURE_MANAGER_H
+#define TEXTURE_MANAGER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <utility>
+#include <algorithm>
+#include <glad/glad.h>
+#include "GLExtensions.h"
+#include "TextureFile.h"
+#include "TextureLoader.h"
+
+using namespace std;
+
+//Keeps the textures of a TextureLoader within a video memory budget.
+//get() hands out reference counted handles, and a texture asked for twice is loaded once.
+//When the textures take more than the budget, update() frees memory from the ones not
+//used this frame, least recently used first: textures without handles are deleted, and
+//the others lose their largest mip levels. Using a texture again streams its levels back
+//in, smallest first, within the same upload budget as TextureLoader::update().
+//
+//Only textures with a TextureFile, those loaded from texture files or through
+//TextureLoader::setMipBuilder() and setEncoding(), can lose levels. Other images are only
+//freed once no handle is left.
+//
+//Evicting levels moves a texture to a new name, so bind the name use() returns every frame.
+class TextureManager {
+	struct Entry;
+
+public:
+	//Reference to a managed texture. Must not outlive its manager.
+	class Handle {
+	public:
+		Handle() {
+		}
+
+		Handle(const Handle &other) : entry(other.entry) {
+			acquire();
+		}
+
+		Handle(Handle &&other) : entry(other.entry) {
+			other.entry = NULL;
+		}
+
+		~Handle() {
+			reset();
+		}
+
+		Handle& operator=(Handle other) {
+			swap(entry, other.entry);
+			return *this;
+		}
+
+		//The texture stays cached until the budget needs its memory
+		void reset() {
+			if (entry != NULL) entry->references--;
+			entry = NULL;
+		}
+
+		bool isValid() const {
+			return entry != NULL;
+		}
+
+	private:
+		friend class TextureManager;
+		Entry* entry = NULL;
+
+		explicit Handle(Entry* entry) : entry(entry) {
+			acquire();
+		}
+
+		void acquire() {
+			if (entry != NULL) entry->references++;
+		}
+	};
+
+	static const size_t DEFAULT_BUDGET = 256 * 1024 * 1024;
+	static const int DEFAULT_MINIMUM_SIZE = 64;
+
+	//Turns on TextureLoader::setKeepFiles(), levels are streamed back in from the files
+	TextureManager(TextureLoader &loader, size_t budget = DEFAULT_BUDGET) : loader(loader), budget(budget) {
+		loader.setKeepFiles(true);
+	}
+
+	~TextureManager() {
+		for (pair<const Key, Entry> &entry : entries) loader.release(entry.second.texture);
+	}
+
+	TextureManager(const TextureManager&) = delete;
+	TextureManager& operator=(const TextureManager&) = delete;
+
+	//See TextureLoader::load()
+	Handle get(string path, GLenum format) {
+		Entry &entry = entries[Key(path, format)];
+		if (entry.texture == 0) {
+			entry.path = path;
+			entry.format = format;
+			entry.texture = loader.load(path, format);
+			entry.lastUsed = frame;
+		}
+		return Handle(&entry);
+	}
+
+	//Name to bind for drawing with the texture this frame. Keeps the texture from being
+	//evicted in the next update() and streams its evicted levels back in.
+	unsigned int use(const Handle &handle) {
+		if (handle.entry == NULL) return 0;
+		handle.entry->lastUsed = frame;
+		return handle.entry->texture;
+	}
+
+	//Kept here once the load is done, evicted textures move to names the loader never saw
+	TextureLoader::State getState(const Handle &handle) {
+		if (handle.entry == NULL) return TextureLoader::FAILED;
+		return handle.entry->loaded ? handle.entry->state : loader.getState(handle.entry->texture);
+	}
+
+	//Stream levels back in, at most budget bytes, and evict down to the memory budget.
+	//Call once per frame on the render thread after TextureLoader::update().
+	//Returns the bytes uploaded.
+	size_t update(size_t budget = TextureLoader::DEFAULT_BUDGET) {
+		for (pair<const Key, Entry> &item : entries) {
+			Entry &entry = item.second;
+			if (entry.loaded) continue;
+			entry.state = loader.getState(entry.texture);
+			if (entry.state == TextureLoader::PENDING) continue;
+			entry.loaded = true;
+			entry.file = loader.getFile(entry.texture);
+			entry.size = loader.getSize(entry.texture);
+			resident += entry.size;
+		}
+
+		size_t uploaded = 0;
+		for (pair<const Key, Entry> &item : entries) {
+			Entry &entry = item.second;
+			if (uploaded >= budget) break;
+			if (entry.references > 0 && entry.lastUsed == frame && entry.file != NULL && entry.base > 0) uploaded += stream(entry, budget - uploaded);
+		}
+
+		if (resident > this->budget) evict(resident - this->budget);
+		frame++;
+		return uploaded;
+	}
+
+	//Bytes of video memory the managed textures may take. Textures in use are never evicted,
+	//so this can be exceeded when a frame uses more.
+	void setBudget(size_t budget) {
+		this->budget = budget;
+	}
+	size_t getBudget() {
+		return budget;
+	}
+
+	//Bytes the managed textures take now
+	size_t getResident() {
+		return resident;
+	}
+
+	//Levels no larger than size on either side are never evicted, so a texture always
+	//has something to show while the rest streams back in
+	void setMinimumSize(int size) {
+		minimumSize = size;
+	}
+
+	void setVerbose(int verbose) {
+		this->verbose = verbose;
+	}
+
+private:
+	typedef pair<string, GLenum> Key;
+
+	struct Entry {
+		string path;
+		GLenum format = GL_RGBA;
+		unsigned int texture = 0;
+		int references = 0;
+		unsigned long long lastUsed = 0;	//Frame of the last use()
+		bool loaded = false;		//No longer PENDING in the loader
+		TextureLoader::State state = TextureLoader::PENDING;	//READY or FAILED once loaded
+		size_t size = 0;			//Bytes resident, including a level being streamed in
+		shared_ptr<TextureFile> file;	//NULL for textures that cannot lose levels
+		int base = 0;				//Largest level resident
+		int rowsUploaded = 0;		//Of level base - 1, while it is streamed in
+	};
+
+	TextureLoader &loader;
+	map<Key, Entry> entries;
+	size_t budget;
+	size_t resident = 0;
+	unsigned long long frame = 0;
+	int minimumSize = DEFAULT_MINIMUM_SIZE;
+	int verbose = false;
+
+	void log(string message) {
+		cout << message << endl;
+	}
+
+	//Upload a band of block rows of the next larger level, at least one, once there is
+	//room for the level. Returns the bytes uploaded.
+	size_t stream(Entry &entry, size_t budget) {
+		TextureFile &file = *entry.file;
+		int index = entry.base - 1;
+		const TextureFile::Level &level = file.levels[index];
+		if (entry.rowsUploaded == 0) {
+			if (resident + level.size > this->budget) evict(resident + level.size - this->budget);
+			if (resident + level.size > this->budget) return 0;
+			resident += level.size;
+			entry.size += level.size;
+		}
+
+		TextureLoader::Binding binding;
+		glBindTexture(GL_TEXTURE_2D, entry.texture);
+		if (entry.rowsUploaded == 0) file.allocate(index);
+
+		int block = TextureFile::blockSize(file.format);
+		size_t bands = budget / TextureFile::levelSize(file.format, level.width, 1);
+		if (bands < 1) bands = 1;
+		int rows = level.height - entry.rowsUploaded;
+		if (bands * block < (size_t)rows) rows = (int)bands * block;
+
+		file.uploadRows(index, entry.rowsUploaded, rows);
+		entry.rowsUploaded += rows;
+		if (entry.rowsUploaded == level.height) {
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, index);
+			entry.base = index;
+			entry.rowsUploaded = 0;
+		}
+		return TextureFile::levelSize(file.format, level.width, rows);
+	}
+
+	//Free at least bytes from textures not used this frame, least recently used first.
+	//Textures without handles go before any others. Returns the bytes freed.
+	size_t evict(size_t bytes) {
+		vector<Entry*> candidates;
+		for (pair<const Key, Entry> &item : entries) {
+			Entry &entry = item.second;
+			if (entry.size == 0) continue;
+			if (entry.references == 0 || (entry.lastUsed != frame && smallestEvictable(entry) > entry.base)) candidates.push_back(&entry);
+		}
+		sort(candidates.begin(), candidates.end(), [](const Entry* a, const Entry* b) {
+			if ((a->references == 0) != (b->references == 0)) return a->references == 0;
+			return a->lastUsed < b->lastUsed;
+		});
+
+		size_t freed = 0;
+		for (Entry* entry : candidates) {
+			if (freed >= bytes) break;
+			if (entry->references == 0) {
+				freed += entry->size;
+				resident -= entry->size;
+				if (verbose) log("Evicted " + entry->path);
+				loader.release(entry->texture);
+				entries.erase(Key(entry->path, entry->format));
+				continue;
+			}
+
+			//Drop the largest levels until enough is freed, along with a level half streamed in
+			int base = entry->base;
+			size_t dropped = entry->rowsUploaded > 0 ? entry->file->levels[base - 1].size : 0;
+			int limit = smallestEvictable(*entry);
+			while (base < limit && freed + dropped < bytes) dropped += entry->file->levels[base++].size;
+			if (verbose) log("Evicted " + to_string(base - entry->base) + " levels of " + entry->path);
+			recreate(*entry, base);
+			freed += dropped;
+			resident -= dropped;
+			entry->size -= dropped;
+		}
+		return freed;
+	}
+
+	//Level a texture can be evicted down to
+	int smallestEvictable(const Entry &entry) {
+		if (entry.file == NULL) return 0;
+		int last = (int)entry.file->levels.size() - 1;
+		for (int i = 0;i < last;i++) {
+			const TextureFile::Level &level = entry.file->levels[i];
+			if (level.width <= minimumSize && level.height <= minimumSize) return i;
+		}
+		return last;
+	}
+
+	//Move the texture to a new name holding only levels from base on. The old storage is
+	//freed with the old name, GL cannot shrink a texture in place.
+	void recreate(Entry &entry, int base) {
+		TextureFile &file = *entry.file;
+		GLExtensions &extensions = GLExtensions::get();
+		TextureLoader::Binding binding;
+
+		glBindTexture(GL_TEXTURE_2D, entry.texture);
+		GLint wrapS, wrapT, magFilter;
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, &wrapS);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, &wrapT);
+		glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, &magFilter);
+
+		unsigned int texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrapS);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrapT);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, base);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)file.levels.size() - 1);
+
+		//Copy the kept levels on the GPU, or upload them again from the file
+		for (int i = base;i < (int)file.levels.size();i++) {
+			const TextureFile::Level &level = file.levels[i];
+			if (extensions.copyImage) {
+				file.allocate(i);
+				extensions.copyImageSubData(entry.texture, GL_TEXTURE_2D, i, 0, 0, 0, texture, GL_TEXTURE_2D, i, 0, 0, 0, level.width, level.height, 1);
+			}
+			else file.upload(i);
+		}
+
+		loader.release(entry.texture);
+		entry.texture = texture;
+		entry.base = base;
+		entry.rowsUploaded = 0;
+	}
+};
+
+#endif
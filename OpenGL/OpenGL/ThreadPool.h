@@ -0,0 +1,120 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+using namespace std;
+
+//Fixed set of worker threads running queued tasks in submission order.
+//Tasks must not touch GL; hand results back to the render thread instead.
+class ThreadPool {
+public:
+	//0 leaves one hardware thread to the render thread
+	ThreadPool(int threads = 0) {
+		if (threads <= 0) threads = (int)thread::hardware_concurrency() - 1;
+		if (threads < 1) threads = 1;
+		for (int i = 0;i < threads;i++) workers.push_back(thread(&ThreadPool::run, this));
+	}
+
+	~ThreadPool() {
+		{
+			lock_guard<mutex> lock(guard);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (thread &worker : workers) worker.join();
+	}
+
+	void submit(function<void()> task) {
+		{
+			lock_guard<mutex> lock(guard);
+			tasks.push_back(task);
+		}
+		wake.notify_one();
+	}
+
+	//Run task(i) for every i in [0, count) on the workers and the calling thread, and return
+	//once all have finished. Safe to call from inside a task: when every worker is busy the
+	//caller works through the indices alone.
+	void parallelFor(int count, function<void(int)> task) {
+		if (count <= 0) return;
+
+		shared_ptr<Batch> batch(new Batch());
+		batch->count = count;
+		batch->task = task;
+		int helpers = count - 1 < size() ? count - 1 : size();
+		for (int i = 0;i < helpers;i++) submit([batch] { batch->work(); });
+		batch->work();
+
+		unique_lock<mutex> lock(batch->guard);
+		batch->finished.wait(lock, [&batch] { return batch->done == batch->count; });
+	}
+
+	//Block until every submitted task has finished
+	void wait() {
+		unique_lock<mutex> lock(guard);
+		idle.wait(lock, [this] { return tasks.empty() && active == 0; });
+	}
+
+	int size() {
+		return (int)workers.size();
+	}
+
+private:
+	//Indices of one parallelFor, claimed by whichever thread gets there first
+	struct Batch {
+		function<void(int)> task;
+		int count = 0;
+		atomic<int> next{ 0 };
+		int done = 0;
+		mutex guard;
+		condition_variable finished;
+
+		void work() {
+			int completed = 0;
+			for (int i = next++;i < count;i = next++) {
+				task(i);
+				completed++;
+			}
+			if (completed == 0) return;
+
+			lock_guard<mutex> lock(guard);
+			done += completed;
+			if (done == count) finished.notify_all();
+		}
+	};
+
+	vector<thread> workers;
+	deque<function<void()>> tasks;
+	mutex guard;
+	condition_variable wake;
+	condition_variable idle;
+	int active = 0;
+	bool stopping = false;
+
+	void run() {
+		unique_lock<mutex> lock(guard);
+		while (true) {
+			wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+			if (tasks.empty()) return;
+
+			function<void()> task = tasks.front();
+			tasks.pop_front();
+			active++;
+			lock.unlock();
+			task();
+			lock.lock();
+			active--;
+			if (tasks.empty() && active == 0) idle.notify_all();
+		}
+	}
+};
+
+#endif
@@ -0,0 +1,322 @@
+#ifndef UNIFORM_H
+#define UNIFORM_H
+
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+using namespace std;
+
+//Typed handle to a uniform of one program. Resolve it once with Shader::uniform<T>(name)
+//and pass it to Shader::set; no string or driver lookup happens after that.
+template<typename T>
+struct Uniform {
+	int location = -1;
+	int index = -1;		//Entry in the program's UniformTable
+
+	bool isValid() const {
+		return location >= 0;
+	}
+};
+
+//GL types a C++ type may be uploaded to
+inline bool uniformTypeMatches(int*, GLenum type) {
+	switch (type) {
+	case GL_INT: case GL_BOOL:
+	case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE:
+	case GL_SAMPLER_2D_SHADOW: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_BUFFER:
+	case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D:
+		return true;
+	}
+	return false;
+}
+inline bool uniformTypeMatches(unsigned int*, GLenum type) { return type == GL_UNSIGNED_INT; }
+inline bool uniformTypeMatches(float*, GLenum type) { return type == GL_FLOAT; }
+inline bool uniformTypeMatches(glm::vec2*, GLenum type) { return type == GL_FLOAT_VEC2; }
+inline bool uniformTypeMatches(glm::vec3*, GLenum type) { return type == GL_FLOAT_VEC3; }
+inline bool uniformTypeMatches(glm::vec4*, GLenum type) { return type == GL_FLOAT_VEC4; }
+inline bool uniformTypeMatches(glm::mat3*, GLenum type) { return type == GL_FLOAT_MAT3; }
+inline bool uniformTypeMatches(glm::mat4*, GLenum type) { return type == GL_FLOAT_MAT4; }
+
+//Layout of an active uniform block as reported by the driver.
+//Offsets are exact for std140 and shared blocks alike.
+struct UniformBlock {
+	struct Member {
+		string name;
+		int offset;
+		GLenum type;
+		int arrayStride;
+		int matrixStride;
+	};
+
+	string name;
+	unsigned int index;
+	int size;				//GL_UNIFORM_BLOCK_DATA_SIZE
+	vector<Member> members;
+
+	//Byte offset of a member, -1 if it is not active
+	int offsetOf(const char* memberName) const {
+		for (const Member &member : members) {
+			if (member.name == memberName) return member.offset;
+		}
+		return -1;
+	}
+};
+
+//Active uniforms of a linked program, built once after link from glGetActiveUniform.
+//Names are looked up through an open addressing table of 32-bit hashes.
+//Every entry also owns a slice of a CPU side shadow copy of the uniform value,
+//which lets setters skip uploads of values the program already holds.
+class UniformTable {
+public:
+	struct Entry {
+		string name;
+		unsigned int hash;
+		int location;
+		GLenum type;
+		int offset;		//Byte offset of the value in the shadow copy
+		int size;		//Byte size of the value
+		bool written;	//Shadow holds the value last uploaded
+		int shadowOf;	//Entry owning the shadow; "name" shares it with "name[0]"
+	};
+
+	vector<Entry> entries;
+	vector<UniformBlock> blocks;
+
+	void build(unsigned int program) {
+		entries.clear();
+		buildBlocks(program);
+
+		GLint count = 0, maxLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+		vector<char> name(maxLength + 16);
+
+		for (GLuint i = 0;i < (GLuint)count;i++) {
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(program, i, (GLsizei)name.size(), NULL, &size, &type, name.data());
+
+			//Members of uniform blocks have no location
+			GLint location = glGetUniformLocation(program, name.data());
+			if (location < 0) continue;
+			int first = (int)entries.size();
+			add(name.data(), location, type);
+
+			//Arrays are reported once as "name[0]"; register "name" and every element
+			char* bracket = strstr(name.data(), "[0]");
+			if (bracket == NULL || bracket[3] != '\0') continue;
+			*bracket = '\0';
+			add(name.data(), location, type);
+			entries.back().shadowOf = first;
+			for (GLint element = 1;element < size;element++) {
+				string elementName = string(name.data()) + "[" + to_string(element) + "]";
+				add(elementName.c_str(), glGetUniformLocation(program, elementName.c_str()), type);
+			}
+		}
+
+		//Shadow storage and location lookup
+		int shadowSize = 0;
+		int maxLocation = -1;
+		for (Entry &entry : entries) {
+			entry.offset = shadowSize;
+			if (&entry == &entries[entry.shadowOf]) shadowSize += entry.size;
+			else entry.offset = entries[entry.shadowOf].offset;
+			if (entry.location > maxLocation) maxLocation = entry.location;
+		}
+		shadow.assign(shadowSize, 0);
+		locations.assign(maxLocation + 1, -1);
+		for (int i = 0;i < (int)entries.size();i++) {
+			if (locations[entries[i].location] < 0) locations[entries[i].location] = i;
+		}
+
+		//Table at most half full, so probes stay short
+		size_t capacity = 8;
+		while (capacity < entries.size() * 2) capacity *= 2;
+		slots.assign(capacity, -1);
+		for (int i = 0;i < (int)entries.size();i++) {
+			size_t slot = entries[i].hash & (capacity - 1);
+			while (slots[slot] >= 0) slot = (slot + 1) & (capacity - 1);
+			slots[slot] = i;
+		}
+	}
+
+	//Index into entries, or -1 if the program has no such active uniform
+	int find(const char* name) const {
+		if (slots.empty()) return -1;
+
+		unsigned int h = hash(name);
+		size_t mask = slots.size() - 1;
+		for (size_t slot = h & mask;slots[slot] >= 0;slot = (slot + 1) & mask) {
+			const Entry &entry = entries[slots[slot]];
+			if (entry.hash == h && entry.name == name) return slots[slot];
+		}
+		return -1;
+	}
+
+	const UniformBlock* block(const char* name) const {
+		for (const UniformBlock &block : blocks) {
+			if (block.name == name) return &block;
+		}
+		return NULL;
+	}
+
+	int location(const char* name) const {
+		int index = find(name);
+		return index >= 0 ? entries[index].location : -1;
+	}
+
+	//Entry holding a location, -1 if unknown
+	int indexOfLocation(int location) const {
+		if (location < 0 || location >= (int)locations.size()) return -1;
+		return locations[location];
+	}
+
+	//Store a new value in the shadow copy. Returns false if it equals the uploaded value,
+	//in which case the glUniform call can be skipped.
+	bool update(int index, const void* value, int size) {
+		if (index < 0) return true;
+
+		Entry &entry = entries[entries[index].shadowOf];
+		if (size > entry.size) size = entry.size;
+		unsigned char* stored = &shadow[entry.offset];
+		if (entry.written && memcmp(stored, value, size) == 0) return false;
+
+		memcpy(stored, value, size);
+		entry.written = true;
+		return true;
+	}
+
+	//Last uploaded value of an entry, NULL if nothing was uploaded through the shadow
+	const void* value(int index) const {
+		const Entry &entry = entries[entries[index].shadowOf];
+		return entry.written ? &shadow[entry.offset] : NULL;
+	}
+
+	//Forget every shadowed value, e.g. after the program was modified outside Shader
+	void invalidate() {
+		for (Entry &entry : entries) entry.written = false;
+	}
+
+	//Bytes of one value of a uniform type
+	static int typeSize(GLenum type) {
+		switch (type) {
+		case GL_FLOAT_VEC2: case GL_INT_VEC2: case GL_UNSIGNED_INT_VEC2: case GL_BOOL_VEC2: return 8;
+		case GL_FLOAT_VEC3: case GL_INT_VEC3: case GL_UNSIGNED_INT_VEC3: case GL_BOOL_VEC3: return 12;
+		case GL_FLOAT_VEC4: case GL_INT_VEC4: case GL_UNSIGNED_INT_VEC4: case GL_BOOL_VEC4: return 16;
+		case GL_FLOAT_MAT2: return 16;
+		case GL_FLOAT_MAT3: return 36;
+		case GL_FLOAT_MAT4: return 64;
+		case GL_FLOAT_MAT2x3: case GL_FLOAT_MAT3x2: return 24;
+		case GL_FLOAT_MAT2x4: case GL_FLOAT_MAT4x2: return 32;
+		case GL_FLOAT_MAT3x4: case GL_FLOAT_MAT4x3: return 48;
+		}
+		return 4;	//Scalars, booleans and samplers
+	}
+
+	//Upload one value of any uniform type from raw bytes. The program must be in use.
+	static void upload(int location, GLenum type, const void* value) {
+		const GLfloat* f = (const GLfloat*)value;
+		const GLint* i = (const GLint*)value;
+		const GLuint* u = (const GLuint*)value;
+		switch (type) {
+		case GL_FLOAT: glUniform1fv(location, 1, f); return;
+		case GL_FLOAT_VEC2: glUniform2fv(location, 1, f); return;
+		case GL_FLOAT_VEC3: glUniform3fv(location, 1, f); return;
+		case GL_FLOAT_VEC4: glUniform4fv(location, 1, f); return;
+		case GL_INT_VEC2: case GL_BOOL_VEC2: glUniform2iv(location, 1, i); return;
+		case GL_INT_VEC3: case GL_BOOL_VEC3: glUniform3iv(location, 1, i); return;
+		case GL_INT_VEC4: case GL_BOOL_VEC4: glUniform4iv(location, 1, i); return;
+		case GL_UNSIGNED_INT: glUniform1uiv(location, 1, u); return;
+		case GL_UNSIGNED_INT_VEC2: glUniform2uiv(location, 1, u); return;
+		case GL_UNSIGNED_INT_VEC3: glUniform3uiv(location, 1, u); return;
+		case GL_UNSIGNED_INT_VEC4: glUniform4uiv(location, 1, u); return;
+		case GL_FLOAT_MAT2: glUniformMatrix2fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT2x3: glUniformMatrix2x3fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT3x2: glUniformMatrix3x2fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT2x4: glUniformMatrix2x4fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT4x2: glUniformMatrix4x2fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT3x4: glUniformMatrix3x4fv(location, 1, GL_FALSE, f); return;
+		case GL_FLOAT_MAT4x3: glUniformMatrix4x3fv(location, 1, GL_FALSE, f); return;
+		}
+		glUniform1iv(location, 1, i);	//Scalars, booleans and samplers
+	}
+
+	static unsigned int hash(const char* name) {
+		unsigned int h = 2166136261u;
+		for (;*name != '\0';name++) {
+			h ^= (unsigned char)*name;
+			h *= 16777619u;
+		}
+		return h;
+	}
+
+private:
+	vector<int> slots;
+	vector<int> locations;			//Location to entry index
+	vector<unsigned char> shadow;
+
+	void buildBlocks(unsigned int program) {
+		blocks.clear();
+
+		GLint count = 0, maxLength = 0, maxUniformLength = 0;
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCKS, &count);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_BLOCK_MAX_NAME_LENGTH, &maxLength);
+		glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxUniformLength);
+		vector<char> name(max(maxLength, maxUniformLength) + 1);
+
+		for (GLuint i = 0;i < (GLuint)count;i++) {
+			UniformBlock block;
+			glGetActiveUniformBlockName(program, i, (GLsizei)name.size(), NULL, name.data());
+			block.name = name.data();
+			block.index = i;
+			glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_DATA_SIZE, &block.size);
+
+			GLint memberCount = 0;
+			glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_ACTIVE_UNIFORMS, &memberCount);
+			vector<GLint> indices(memberCount);
+			if (memberCount > 0) glGetActiveUniformBlockiv(program, i, GL_UNIFORM_BLOCK_ACTIVE_UNIFORM_INDICES, indices.data());
+
+			vector<GLuint> members(indices.begin(), indices.end());
+			vector<GLint> offsets(memberCount), types(memberCount), arrayStrides(memberCount), matrixStrides(memberCount);
+			if (memberCount > 0) {
+				glGetActiveUniformsiv(program, memberCount, members.data(), GL_UNIFORM_OFFSET, offsets.data());
+				glGetActiveUniformsiv(program, memberCount, members.data(), GL_UNIFORM_TYPE, types.data());
+				glGetActiveUniformsiv(program, memberCount, members.data(), GL_UNIFORM_ARRAY_STRIDE, arrayStrides.data());
+				glGetActiveUniformsiv(program, memberCount, members.data(), GL_UNIFORM_MATRIX_STRIDE, matrixStrides.data());
+			}
+			for (int m = 0;m < memberCount;m++) {
+				glGetActiveUniformName(program, members[m], (GLsizei)name.size(), NULL, name.data());
+				UniformBlock::Member member;
+				member.name = name.data();
+				member.offset = offsets[m];
+				member.type = (GLenum)types[m];
+				member.arrayStride = arrayStrides[m];
+				member.matrixStride = matrixStrides[m];
+				block.members.push_back(member);
+			}
+			blocks.push_back(block);
+		}
+	}
+
+	void add(const char* name, int location, GLenum type) {
+		if (location < 0) return;
+		Entry entry;
+		entry.name = name;
+		entry.hash = hash(name);
+		entry.location = location;
+		entry.type = type;
+		entry.offset = 0;
+		entry.size = typeSize(type);
+		entry.written = false;
+		entry.shadowOf = (int)entries.size();
+		entries.push_back(entry);
+	}
+};
+
+#endif
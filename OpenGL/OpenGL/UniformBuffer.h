@@ -0,0 +1,157 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <glad/glad.h>
+#include "GLExtensions.h"
+
+using namespace std;
+
+//Ring of uniform buffer memory handing out aligned blocks for per-draw and per-frame data.
+//The buffer is split into one segment per frame in flight; a segment is reused only after
+//the fence of the frame that last used it has signaled.
+//
+//With GL_ARB_buffer_storage the buffer is persistently mapped and blocks are written in
+//place. Otherwise blocks are staged in client memory and flush() uploads the frame's
+//segment with a single glBufferSubData.
+//
+//Per frame: beginFrame, allocate and fill every block, flush, bind blocks and draw, endFrame.
+class UniformRing {
+public:
+	struct Block {
+		unsigned char* data = NULL;	//Write the block contents here
+		GLintptr offset = 0;		//Offset in the buffer, for glBindBufferRange
+		GLsizeiptr size = 0;
+
+		bool isValid() const {
+			return data != NULL;
+		}
+	};
+
+	unsigned int ID = 0;
+
+	UniformRing(GLsizeiptr frameSize, int framesInFlight = 3) {
+		GLint alignment = 256;
+		glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+		this->alignment = alignment;
+		this->frameSize = align(frameSize);
+		segments.resize(framesInFlight, NULL);
+
+		GLsizeiptr totalSize = this->frameSize * framesInFlight;
+		glGenBuffers(1, &ID);
+		glBindBuffer(GL_UNIFORM_BUFFER, ID);
+
+		GLExtensions &extensions = GLExtensions::get();
+		if (extensions.bufferStorage) {
+			GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+			extensions.bufferStorageAllocate(GL_UNIFORM_BUFFER, totalSize, NULL, flags);
+			mapped = (unsigned char*)glMapBufferRange(GL_UNIFORM_BUFFER, 0, totalSize, flags);
+		}
+		if (mapped == NULL) {
+			glBufferData(GL_UNIFORM_BUFFER, totalSize, NULL, GL_STREAM_DRAW);
+			staging.resize(this->frameSize);
+		}
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+
+	~UniformRing() {
+		for (GLsync fence : segments) {
+			if (fence != NULL) glDeleteSync(fence);
+		}
+		if (mapped != NULL) {
+			glBindBuffer(GL_UNIFORM_BUFFER, ID);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		}
+		glDeleteBuffers(1, &ID);
+	}
+
+	bool isPersistent() {
+		return mapped != NULL;
+	}
+
+	//Start filling the next segment. Waits only if the GPU is a whole ring behind.
+	void beginFrame() {
+		segment = (segment + 1) % segments.size();
+		GLsync &fence = segments[segment];
+		if (fence != NULL) {
+			glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+			glDeleteSync(fence);
+			fence = NULL;
+		}
+		used = 0;
+		flushed = 0;
+	}
+
+	//Returns an invalid block once the frame's segment is full
+	Block allocate(GLsizeiptr size) {
+		Block block;
+		GLsizeiptr aligned = align(size);
+		if (used + aligned > frameSize) {
+			overflows++;
+			return block;
+		}
+
+		block.offset = segment * frameSize + used;
+		block.size = size;
+		block.data = mapped != NULL ? mapped + block.offset : staging.data() + used;
+		used += aligned;
+		return block;
+	}
+
+	//Allocate a block and copy a std140 compatible struct into it
+	template<typename T>
+	Block push(const T &value) {
+		Block block = allocate(sizeof(T));
+		if (block.isValid()) memcpy(block.data, &value, sizeof(T));
+		return block;
+	}
+
+	//Make the blocks allocated so far visible to the GPU. Call before drawing with them.
+	void flush() {
+		if (mapped != NULL || used == flushed) return;
+
+		glBindBuffer(GL_UNIFORM_BUFFER, ID);
+		glBufferSubData(GL_UNIFORM_BUFFER, segment * frameSize + flushed, used - flushed, staging.data() + flushed);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+		flushed = used;
+	}
+
+	void bind(unsigned int binding, const Block &block) {
+		glBindBufferRange(GL_UNIFORM_BUFFER, binding, ID, block.offset, block.size);
+	}
+
+	//Fence the segment so it is not overwritten while the GPU still reads it
+	void endFrame() {
+		flush();
+		segments[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+
+	//Bytes allocated this frame and allocations refused because a segment was full
+	GLsizeiptr bytesUsed() {
+		return used;
+	}
+	unsigned int overflowCount() {
+		return overflows;
+	}
+
+private:
+	GLsizeiptr alignment;
+	GLsizeiptr frameSize;
+	vector<GLsync> segments;
+	size_t segment = 0;
+	GLsizeiptr used = 0;
+	GLsizeiptr flushed = 0;
+	unsigned int overflows = 0;
+	unsigned char* mapped = NULL;
+	vector<unsigned char> staging;
+
+	GLsizeiptr align(GLsizeiptr size) {
+		return (size + alignment - 1) / alignment * alignment;
+	}
+};
+
+#endif
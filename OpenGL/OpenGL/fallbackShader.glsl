@@ -0,0 +1,9 @@
+#version 330 core
+
+out vec4 FragColor;
+
+//Drawn while the scene shaders compile
+void main()
+{
+    FragColor = vec4(0.5, 0.5, 0.5, 1.0);
+}
\ No newline at end of file
@@ -6,12 +6,30 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
-#include <Windows.h>
+#include <vector>
+#include <cstring>
+#include <climits>
 #include "Shader.h"
+#include "ShaderCompiler.h"
+#include "ShaderLibrary.h"
+#include "ProgramCache.h"
+#include "UniformBuffer.h"
+#include "GLExtensions.h"
+#include "Framebuffer.h"
+#include "Profiler.h"
+#include "GpuProfiler.h"
+#include "StagingRing.h"
+#include "TextureLoader.h"
+#include "TextureManager.h"
+#include "TextureFile.h"
+#include "TextureEncoder.h"
+#include "MipBuilder.h"
 #include "stb_image.h"
 #include <chrono>
+#ifdef _WIN32
 #include <windows.h>
 #include "wglext.h"
+#endif
 
 using namespace std;
 using namespace glm;
@@ -24,23 +42,15 @@ void log(string str) {
 	cout << str << endl;
 }
 
-int index = 0;
-chrono::time_point<chrono::steady_clock> listTimestamp[100];
-string listTimestampLog[100];
+//Print the profiler summary and write the trace requested on the command line
+void writeProfile(string tracePath) {
+	Profiler &profiler = Profiler::instance();
+	profiler.report(cout);
+	if (tracePath.empty()) return;
 
-void checkTime(string log) {
-	listTimestamp[index] = chrono::high_resolution_clock::now();
-	listTimestampLog[index] = log;
-	index++;
-	if (index > 99)index = 0;
-}
-
-void listTimeSpent() {
-	chrono::time_point<chrono::steady_clock> bef = listTimestamp[0];
-	for (int i = 0;i < index;i++) {
-		int dt = (int)std::chrono::duration_cast<std::chrono::nanoseconds>(listTimestamp[i] - bef).count();
-		cout << listTimestampLog[i] << "\t" << dt / 1000 << " us" << endl;
-	}
+	profiler.stopCapture();
+	if (profiler.writeChromeTrace(tracePath)) log("Trace written to " + tracePath);
+	else log("Failed to write trace " + tracePath);
 }
 
 //============================================================
@@ -48,6 +58,68 @@ void listTimeSpent() {
 const float SCR_WIDTH = 800.f;
 const float SCR_HEIGHT = 600.f;
 
+//Command line options
+struct Options {
+	bool headless = false;	//Render offscreen without a visible window. Off Windows this needs a glfw built with OSMesa, or a display such as Xvfb
+	int frames = 300;		//Number of frames to render in headless mode
+	bool readback = false;	//Read every frame back to the CPU
+	string dumpPrefix;		//Write read back frames as <prefix>_<frame>.ppm
+	int dumpEvery = 1;		//Only dump every n-th frame
+	string tracePath;		//Write a Chrome trace of the profiled zones here on exit
+	bool shaderCache = true;	//Reuse program binaries from the shadercache directory
+	string benchDecode;		//Time decoding this image at every SIMD level and on threads, check the pixels match, and exit
+	int benchRuns = 10;		//Decodes per SIMD level
+	string convertInput;	//Convert this image into a texture file and exit
+	string convertOutput;
+	string convertFormat = "bc3";	//TextureFile::formatName of the output
+	bool convertSrgb = false;	//Mark the output as sRGB color, and filter the mips in linear light
+	bool convertMips = true;	//Store a full mip chain
+	string filter = "kaiser";	//MipBuilder::filterName for --convert and --bench-mips
+	float alphaCutoff = 0;		//Keep the coverage of this alpha test in every mip
+	string quality = "normal";	//TextureEncoder::qualityName for --convert and --bench-encode
+	string benchEncode;		//Time encoding this image into every block format and exit
+	string benchMips;		//Time building the mip chain of this image and exit
+	int textureBudget = 256;	//Megabytes of video memory for textures, see TextureManager
+};
+
+Options parseOptions(int argc, char** argv) {
+	Options options;
+	for (int i = 1;i < argc;i++) {
+		string arg = argv[i];
+		bool hasValue = i + 1 < argc;
+		if (arg == "--headless") options.headless = true;
+		else if (arg == "--readback") options.readback = true;
+		else if (arg == "--no-shader-cache") options.shaderCache = false;
+		else if (arg == "--frames" && hasValue) options.frames = atoi(argv[++i]);
+		else if (arg == "--dump" && hasValue) {
+			options.dumpPrefix = argv[++i];
+			options.readback = true;
+		}
+		else if (arg == "--trace" && hasValue) options.tracePath = argv[++i];
+		else if (arg == "--dump-every" && hasValue) options.dumpEvery = atoi(argv[++i]);
+		else if (arg == "--bench-decode" && hasValue) options.benchDecode = argv[++i];
+		else if (arg == "--bench-runs" && hasValue) options.benchRuns = atoi(argv[++i]);
+		else if (arg == "--convert" && i + 2 < argc) {
+			options.convertInput = argv[++i];
+			options.convertOutput = argv[++i];
+		}
+		else if (arg == "--format" && hasValue) options.convertFormat = argv[++i];
+		else if (arg == "--srgb") options.convertSrgb = true;
+		else if (arg == "--no-mips") options.convertMips = false;
+		else if (arg == "--quality" && hasValue) options.quality = argv[++i];
+		else if (arg == "--bench-encode" && hasValue) options.benchEncode = argv[++i];
+		else if (arg == "--filter" && hasValue) options.filter = argv[++i];
+		else if (arg == "--alpha-cutoff" && hasValue) options.alphaCutoff = (float)atof(argv[++i]);
+		else if (arg == "--bench-mips" && hasValue) options.benchMips = argv[++i];
+		else if (arg == "--texture-budget" && hasValue) options.textureBudget = atoi(argv[++i]);
+		else log("Unknown option: " + arg);
+	}
+	if (options.dumpEvery < 1) options.dumpEvery = 1;
+	if (options.benchRuns < 1) options.benchRuns = 1;
+	return options;
+}
+
+#ifdef _WIN32
 bool WGLExtensionSupported(const char *extension_name)
 {
 	// this is pointer to function which returns pointer to string with list of all wgl extensions
@@ -65,6 +137,7 @@ bool WGLExtensionSupported(const char *extension_name)
 	// extension is supported
 	return true;
 }
+#endif
 
 glm::vec3 cameraPos = glm::vec3(0.0f, 0.0f, -3.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
@@ -77,31 +150,6 @@ float dx = 0;
 float dy = 0;
 float vy = 0;
 
-//Load image from given file path, create texture, free image.
-unsigned int getTexture(string texturePath, GLint type, unsigned int* width = NULL, unsigned int* height = NULL, unsigned int* channels = NULL) {
-	unsigned int texture;
-	glGenTextures(1, &texture);				//Generate empty texture
-	glBindTexture(GL_TEXTURE_2D, texture);	//Bind texture to TEXTURE_2D
-
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-
-	int w, h, c;																	//Width, height, channels
-	unsigned char *data = stbi_load(texturePath.c_str(), &w, &h, &c, 0);			//Load image
-	glTexImage2D(GL_TEXTURE_2D, 0, type, w, h, 0, type, GL_UNSIGNED_BYTE, data);	//Assign image
-	glGenerateMipmap(GL_TEXTURE_2D);												//Generate mipmap
-
-	stbi_image_free(data);
-
-	if (width != NULL)*width = w;
-	if (height != NULL)*height = h;
-	if (channels != NULL)*channels = c;
-
-	return texture;
-}
-
 //Resize callback
 void framebuffer_size_callback(GLFWwindow* window, int width, int height)
 {
@@ -122,18 +170,37 @@ void processInput(GLFWwindow *window)
 }
 
 //Initializing process
-GLFWwindow* init(int width, int height) {
+GLFWwindow* init(int width, int height, bool headless = false) {
 	glfwInit();														//Inifialize glfw
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);					//Set glfw major version(3)
 	glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);					//Set glfw minor version(3)
 	glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);	//Set profile
 	//glfwWindowHint(GLFW_REFRESH_RATE, 0);							//Set FPS
 
+	//Headless mode renders into a framebuffer object, so the window is never shown.
+	//Off Windows, glfw has to be built with OSMesa to get a context without a display;
+	//the glfw binaries in this repository are Win32 only, so link against a system glfw
+	//there. Without OSMesa a hidden window on a display, e.g. Xvfb, is tried instead.
+	if (headless) {
+		glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+#ifndef _WIN32
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_OSMESA_CONTEXT_API);
+#endif
+	}
+
 	//Create window with size and title
 	GLFWwindow* window = glfwCreateWindow(width, height, "OpenGL", NULL, NULL);
+#ifndef _WIN32
+	if (window == NULL && headless) {
+		log("No OSMesa context, trying a hidden window on the display");
+		glfwWindowHint(GLFW_CONTEXT_CREATION_API, GLFW_NATIVE_CONTEXT_API);
+		window = glfwCreateWindow(width, height, "OpenGL", NULL, NULL);
+	}
+#endif
 	if (window == NULL)
 	{
-		log("Failed to create GLFW window");
+		if (headless) log("Failed to create GLFW window: headless mode needs a glfw built with OSMesa, or a display such as Xvfb");
+		else log("Failed to create GLFW window");
 		glfwTerminate();
 		return NULL;
 	}
@@ -147,88 +214,80 @@ GLFWwindow* init(int width, int height) {
 		log("Failed to initialize GLAD");
 		return NULL;
 	}
+	GLExtensions::get().load((GLADloadproc)glfwGetProcAddress);
 
 	//Set Viewport
 	glViewport(0, 0, width, height);
 	return window;
 }
 
-int main()
-{
-	log("Starting...");
-	GLFWwindow* window = init((int)SCR_WIDTH, (int)SCR_HEIGHT);
-	if (window == NULL) return -1;
-
-	//Add resize callback
-	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
+//Uniform buffer binding points of the blocks in vertexShader.glsl
+const unsigned int CAMERA_BINDING = 0;
+const unsigned int OBJECT_BINDING = 1;
+
+//std140 layouts of the Camera and Object blocks
+struct CameraBlock {
+	mat4 view;
+	mat4 projection;
+};
+struct ObjectBlock {
+	mat4 model;
+};
+
+//Everything drawScene needs besides the camera
+struct Scene {
+	Shader* shader;
+	Shader* fallback;	//Drawn with until shader is ready
+	unsigned int VAO;
+	UniformRing* uniforms;
+	TextureManager* textures;
+	TextureManager::Handle texture;
+	mat4 model;
+	mat4 projection;
+};
+
+//Draw one frame of the scene into the bound framebuffer
+void drawScene(Scene &scene, mat4 &view) {
+	PROFILE_ZONE("drawScene");
 
 	//============================================================
-	//Define vertex
+	//GPU associated part
 	//============================================================
 
-	//New vertex
-	float vertices[] = {
-			-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-			 0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
-			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
-
-			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-			 0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-			 0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
-			-0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
-			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-
-			-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-			-0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-			-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	//Graphic initialize Process
+	{
+		GPU_ZONE("clear");
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);	//Clear
+	}
 
-			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-			 0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-			 0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-			 0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+	//Draw with the fallback while the program compiles
+	Shader* shader = ShaderCompiler::select(scene.shader, scene.fallback);
+	if (shader == NULL) return;
 
-			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
-			 0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
-			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
-			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
-			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+	//Update position and rotation
+	UniformRing &uniforms = *scene.uniforms;
+	uniforms.beginFrame();
+	UniformRing::Block camera = uniforms.push(CameraBlock{ view, scene.projection });
+	UniformRing::Block object = uniforms.push(ObjectBlock{ scene.model });
+	uniforms.flush();
 
-			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
-			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
-			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
-			-0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
-			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f
-	};
+	//Use shader
+	shader->use();
+	uniforms.bind(CAMERA_BINDING, camera);
+	uniforms.bind(OBJECT_BINDING, object);
 
-	//Vertex buffer object
-	unsigned int VBO;					//Buffer id
-	glGenBuffers(1, &VBO);				//Get buffer
-	glBindBuffer(GL_ARRAY_BUFFER, VBO);	//Bind buffer
+	//Bound every frame, eviction may move the texture to a new name
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, scene.textures->use(scene.texture));
 
-	//Veretex array object
-	unsigned int VAO;					//Array id
-	glGenVertexArrays(1, &VAO);			//Get array
-	glBindVertexArray(VAO);				//Bind array
+	//Update buffer change
+	//glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-	//Initialze code
-	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	//============================================================
+	//Drawing process
+	//============================================================
 
-	//Element buffer object
-	//unsigned int EBO;
-	//glGenBuffers(1, &EBO);
-	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-	//glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+	glBindVertexArray(scene.VAO);
 
 	//Position attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(0 * sizeof(float)));
@@ -238,6 +297,334 @@ int main()
 	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
 	glEnableVertexAttribArray(1);
 
+	{
+		GPU_ZONE("draw");
+		glDrawArrays(GL_TRIANGLES, 0, 36);
+	}
+
+	//Uncommenet here swhen use element buffer object
+	//Primitive types, array start inex, number of vertex(3 for triangles)
+	//glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+
+	//Release resource
+	glBindVertexArray(0);
+	glDisableVertexAttribArray(0);
+	glDisableVertexAttribArray(1);
+
+	shader->stop();
+	uniforms.endFrame();
+}
+
+//Point a program at the texture unit and uniform blocks drawScene uses. Call once it is ready.
+void configureShader(Shader &shader) {
+	shader.use();
+	shader.setInt("texture1", 0);
+	//shader.setInt("texture2", 1);
+	shader.bindUniformBlock("Camera", CAMERA_BINDING);
+	shader.bindUniformBlock("Object", OBJECT_BINDING);
+	shader.stop();
+}
+
+//Called for every frame read back in headless mode
+void onFrameReadback(int frame, const unsigned char* pixels, int width, int height, void* user) {
+	Options* options = (Options*)user;
+	if (options->dumpPrefix.empty() || frame % options->dumpEvery != 0) return;
+
+	char suffix[16];
+	snprintf(suffix, sizeof(suffix), "_%05d.ppm", frame);
+	if (!FrameReadback::writePPM(options->dumpPrefix + suffix, pixels, width, height)) log("Failed to write frame " + to_string(frame));
+}
+
+//Render one frame of the fixed camera orbit and queue its readback
+void renderHeadlessFrame(Options &options, int frame, Scene &scene, FrameReadback &readback, FrameTimer &timer) {
+	PROFILE_ZONE("frame");
+
+	float yaw = 360.0f * frame / options.frames;
+	vec3 front = vec3(cos(radians(yaw)), 0.0f, sin(radians(yaw)));
+	cameraPos = -3.0f * front;
+	mat4 view = lookAt(cameraPos, cameraPos + front, cameraUp);
+
+	timer.begin(frame);
+	drawScene(scene, view);
+	timer.end();
+
+	PROFILE_ZONE("readback");
+	if (options.readback) readback.request(frame, onFrameReadback, &options);
+	readback.poll(onFrameReadback, &options);
+	timer.poll();
+	glFlush();
+}
+
+//Render a fixed number of frames into an offscreen framebuffer and report frame times.
+//The camera orbits on a fixed path so that runs are comparable.
+int runHeadless(Options &options, Scene &scene) {
+	Framebuffer framebuffer((int)SCR_WIDTH, (int)SCR_HEIGHT);
+	if (!framebuffer.isComplete()) return -1;
+
+	FrameReadback readback(framebuffer.width, framebuffer.height);
+	FrameTimer timer;
+	vector<long long> cpuTimes;
+	unsigned long long uniformBytes = 0;
+
+	framebuffer.bind();
+	for (int frame = 0;frame < options.frames;frame++) {
+		chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+		renderHeadlessFrame(options, frame, scene, readback, timer);
+		cpuTimes.push_back(chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
+		uniformBytes += scene.uniforms->bytesUsed();
+		GpuProfiler::instance().endFrame();
+		Profiler::instance().endFrame();
+	}
+	readback.flush(onFrameReadback, &options);
+	timer.poll(true);
+	framebuffer.unbind();
+
+	//Report
+	long long cpuTotal = 0, gpuTotal = 0;
+	long long cpuMin = LLONG_MAX, cpuMax = 0;
+	cout << "frame\tcpu us\tgpu us" << endl;
+	for (int frame = 0;frame < options.frames;frame++) {
+		long long cpu = cpuTimes[frame];
+		long long gpu = frame < (int)timer.results.size() ? (long long)timer.results[frame] : 0;
+		cout << frame << "\t" << cpu / 1000 << "\t" << gpu / 1000 << endl;
+		cpuTotal += cpu;
+		gpuTotal += gpu;
+		if (cpu < cpuMin) cpuMin = cpu;
+		if (cpu > cpuMax) cpuMax = cpu;
+	}
+	if (options.frames > 0) {
+		cout << "cpu avg " << cpuTotal / options.frames / 1000 << " us, min " << cpuMin / 1000 << " us, max " << cpuMax / 1000 << " us" << endl;
+		cout << "gpu avg " << gpuTotal / options.frames / 1000 << " us" << endl;
+		cout << "uniform bytes avg " << uniformBytes / options.frames << ", overflows " << scene.uniforms->overflowCount() << endl;
+		cout << "fps " << (cpuTotal > 0 ? 1e9 * options.frames / cpuTotal : 0.0) << endl;
+	}
+	return 0;
+}
+
+//stb_image hook running decoding tasks on a thread pool
+void decodeParallelFor(void* context, int count, stbi_parallel_task* task, void* taskData) {
+	((ThreadPool*)context)->parallelFor(count, [task, taskData](int index) { task(taskData, index); });
+}
+
+//Decode an image from memory with the scalar, SSE2 and AVX2 kernels in turn, then with
+//the best kernels on the thread pool, and report the throughput in megabytes of decoded
+//pixels per second. Levels the CPU lacks are skipped. Every pass has to match the serial
+//scalar pixels, or is reported as a MISMATCH.
+int runDecodeBenchmark(Options &options) {
+	ifstream in(options.benchDecode, ios::binary);
+	vector<char> file((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+	if (!in || file.empty()) {
+		log("Cannot read " + options.benchDecode);
+		return -1;
+	}
+
+	ThreadPool pool;
+	static const char* names[] = { "scalar", "sse2", "avx2", "threads" };
+	vector<unsigned char> reference;
+	for (int mode = 0;mode < 4;mode++) {
+		int level = mode < 3 ? mode : STBI_simd_avx2;
+		stbi_set_simd_level(level);
+		if (mode < 3 && stbi_get_simd_level() != level) {
+			cout << names[mode] << "\tnot supported" << endl;
+			continue;
+		}
+		if (mode == 3) stbi_set_parallel_for(decodeParallelFor, &pool);
+
+		long long total = 0;
+		size_t size = 0;
+		bool same = true;
+		for (int run = 0;run < options.benchRuns;run++) {
+			int width, height, channels;
+			chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+			unsigned char* pixels = stbi_load_from_memory((const stbi_uc*)file.data(), (int)file.size(), &width, &height, &channels, 0);
+			total += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+			if (pixels == NULL) {
+				log("Cannot decode " + options.benchDecode + ": " + stbi_failure_reason());
+				stbi_set_simd_level(STBI_simd_avx2);
+				stbi_set_parallel_for(NULL, NULL);
+				return -1;
+			}
+
+			//Every mode has to produce the same pixels as the serial scalar code
+			size = (size_t)width * height * channels;
+			if (reference.empty()) reference.assign(pixels, pixels + size);
+			else if (run == 0) same = memcmp(reference.data(), pixels, size) == 0;
+			stbi_image_free(pixels);
+		}
+		double seconds = total / 1e9;
+		cout << names[mode] << "\t" << total / options.benchRuns / 1000 << " us\t" << size * options.benchRuns / seconds / 1e6 << " MB/s" << (same ? "" : "\tMISMATCH") << endl;
+	}
+	stbi_set_simd_level(STBI_simd_avx2);
+	stbi_set_parallel_for(NULL, NULL);
+
+	//Previews, scaled while decoding
+	for (int scale = 2;scale <= 8;scale *= 2) {
+		long long total = 0;
+		int width = 0, height = 0, channels;
+		for (int run = 0;run < options.benchRuns;run++) {
+			chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+			unsigned char* pixels = stbi_load_scaled_from_memory((const stbi_uc*)file.data(), (int)file.size(), &width, &height, &channels, 0, scale);
+			total += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+			stbi_image_free(pixels);
+		}
+		cout << "1/" << scale << "\t" << total / options.benchRuns / 1000 << " us\t" << width << "x" << height << endl;
+	}
+	return 0;
+}
+
+//Encode an image and its mip chain into a texture file that TextureLoader uploads as is
+int runConvert(Options &options) {
+	TextureFile::Format format = TextureFile::parseFormat(options.convertFormat);
+	TextureEncoder::Quality quality;
+	if (!TextureEncoder::canEncode(format)) {
+		log("Cannot encode format " + options.convertFormat);
+		return -1;
+	}
+	if (!TextureEncoder::parseQuality(options.quality, quality)) {
+		log("Unknown quality " + options.quality);
+		return -1;
+	}
+	MipBuilder::Settings settings;
+	if (!MipBuilder::parseFilter(options.filter, settings.filter)) {
+		log("Unknown filter " + options.filter);
+		return -1;
+	}
+	settings.srgb = options.convertSrgb;
+	settings.alphaCutoff = options.alphaCutoff;
+
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(options.convertInput.c_str(), &width, &height, &channels, 4);
+	if (pixels == NULL) {
+		log("Cannot load " + options.convertInput + ": " + stbi_failure_reason());
+		return -1;
+	}
+
+	chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+	ThreadPool pool;
+	vector<vector<unsigned char>> mips, levels;
+	if (options.convertMips) MipBuilder::build(pixels, width, height, settings, mips, &pool);
+	else mips.push_back(vector<unsigned char>(pixels, pixels + (size_t)width * height * 4));
+	stbi_image_free(pixels);
+	TextureEncoder::encodeChain(format, mips, width, height, levels, quality, &pool);
+
+	if (!TextureFile::write(options.convertOutput, format, options.convertSrgb, width, height, levels)) {
+		log("Cannot write " + options.convertOutput);
+		return -1;
+	}
+	long long elapsed = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+	cout << options.convertOutput << ": " << width << "x" << height << " " << TextureFile::formatName(format) << (options.convertSrgb ? " srgb" : "") << " " << options.quality << ", " << levels.size() << " " << options.filter << " levels, " << elapsed << " ms" << endl;
+	return 0;
+}
+
+//Encode an image into every block format the encoder writes, with the scalar and SSE2
+//searches on one thread and SSE2 on the thread pool, and report the time and the PSNR.
+int runEncodeBenchmark(Options &options) {
+	TextureEncoder::Quality quality;
+	if (!TextureEncoder::parseQuality(options.quality, quality)) {
+		log("Unknown quality " + options.quality);
+		return -1;
+	}
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(options.benchEncode.c_str(), &width, &height, &channels, 4);
+	if (pixels == NULL) {
+		log("Cannot load " + options.benchEncode + ": " + stbi_failure_reason());
+		return -1;
+	}
+
+	ThreadPool pool;
+	double megapixels = (double)width * height / 1e6;
+	cout << options.benchEncode << ": " << width << "x" << height << ", " << options.quality << ", " << pool.size() + 1 << " threads" << endl;
+	cout << "format\tscalar\tsse2\tthreads\tMpx/s\tpsnr" << endl;
+	for (int format = TextureFile::BC1;format <= TextureFile::BC7;format++) {
+		long long times[3] = {};
+		vector<unsigned char> outputs[3];
+		double error = 0;
+		for (int mode = 0;mode < 3;mode++) {
+			TextureEncoder::setSimd(mode > 0);
+			if (mode == 1 && !TextureEncoder::isSimd()) continue;
+			for (int run = 0;run < options.benchRuns;run++) {
+				chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+				TextureEncoder::encode((TextureFile::Format)format, pixels, width, height, outputs[mode], quality, mode == 2 ? &pool : NULL, &error);
+				times[mode] += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+			}
+			times[mode] /= options.benchRuns;
+		}
+		TextureEncoder::setSimd(true);
+
+		//Every mode has to write the same blocks
+		bool same = (outputs[1].empty() || outputs[1] == outputs[0]) && outputs[2] == outputs[0];
+		cout << TextureFile::formatName((TextureFile::Format)format);
+		for (int mode = 0;mode < 3;mode++) {
+			if (outputs[mode].empty()) cout << "\t-";
+			else cout << "\t" << times[mode] / 1000.0 << " ms";
+		}
+		double psnr = error > 0 ? 10 * log10(255.0 * 255.0 / error) : 99;
+		cout << "\t" << (times[2] > 0 ? megapixels * 1e6 / times[2] : 0.0) << "\t" << psnr << " dB" << (same ? "" : "\tMISMATCH") << endl;
+	}
+	stbi_image_free(pixels);
+	return 0;
+}
+
+//Build the mip chain of an image with the scalar, SSE2 and AVX2 filters on one thread and
+//with the best filter on the thread pool, then a batch of copies one image per thread.
+int runMipBenchmark(Options &options) {
+	MipBuilder::Settings settings;
+	if (!MipBuilder::parseFilter(options.filter, settings.filter)) {
+		log("Unknown filter " + options.filter);
+		return -1;
+	}
+	settings.srgb = options.convertSrgb;
+	settings.alphaCutoff = options.alphaCutoff;
+	int width, height, channels;
+	unsigned char* pixels = stbi_load(options.benchMips.c_str(), &width, &height, &channels, 4);
+	if (pixels == NULL) {
+		log("Cannot load " + options.benchMips + ": " + stbi_failure_reason());
+		return -1;
+	}
+
+	ThreadPool pool;
+	cout << options.benchMips << ": " << width << "x" << height << ", " << options.filter << (settings.srgb ? " srgb" : "") << ", " << pool.size() + 1 << " threads" << endl;
+	static const char* names[] = { "scalar", "sse2", "avx2", "threads" };
+	vector<vector<unsigned char>> reference;
+	for (int mode = 0;mode < 4;mode++) {
+		int level = mode < 3 ? mode : STBI_simd_avx2;
+		stbi_set_simd_level(level);
+		if (mode < 3 && stbi_get_simd_level() != level) {
+			cout << names[mode] << "\tnot supported" << endl;
+			continue;
+		}
+
+		long long total = 0;
+		vector<vector<unsigned char>> levels;
+		for (int run = 0;run < options.benchRuns;run++) {
+			chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+			MipBuilder::build(pixels, width, height, settings, levels, mode == 3 ? &pool : NULL);
+			total += chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+		}
+		//Every mode has to build the same levels
+		if (reference.empty()) reference = levels;
+		cout << names[mode] << "\t" << total / options.benchRuns / 1000.0 << " ms" << (levels == reference ? "" : "\tMISMATCH") << endl;
+	}
+	stbi_set_simd_level(STBI_simd_avx2);
+
+	vector<MipBuilder::Image> images(pool.size() + 1);
+	for (MipBuilder::Image &image : images) {
+		image.rgba = pixels;
+		image.width = width;
+		image.height = height;
+	}
+	chrono::time_point<chrono::steady_clock> start = chrono::steady_clock::now();
+	MipBuilder::buildAll(images, settings, pool);
+	long long total = chrono::duration_cast<chrono::microseconds>(chrono::steady_clock::now() - start).count();
+	cout << images.size() << " images\t" << total / 1000.0 << " ms, " << total / 1000.0 / images.size() << " ms each" << endl;
+	stbi_image_free(pixels);
+	return 0;
+}
+
+//Load the shaders and textures, then draw until the window closes or run the headless
+//capture. Everything owning GL objects lives in here, so it is destroyed before main()
+//terminates GLFW and the context goes away.
+int runScene(Options &options, GLFWwindow* window, unsigned int VAO) {
 	//============================================================
 	//Define texture
 	//============================================================
@@ -248,18 +635,33 @@ int main()
 
 	//Link shaders with program
 
-	Shader shader = Shader("vertexShader.glsl", "fragmentShader.glsl");
-	unsigned int texture1 = getTexture("texture.jpeg", GL_RGB);
-	unsigned int texture2 = getTexture("awesomeface.png", GL_RGBA);
+	//Only created when enabled, creating it makes the directory
+	unique_ptr<ProgramCache> programCache;
+	if (options.shaderCache) programCache.reset(new ProgramCache("shadercache"));
+	Shader::setProgramCache(programCache.get());
+
+	//Programs compile and textures decode in the background
+	StagingRing staging;
+	TextureLoader textures(&staging);
+	textures.setVerbose(true);
+	TextureManager residency(textures, (size_t)options.textureBudget * 1024 * 1024);
+	residency.setVerbose(true);
+	ShaderCompiler compiler;
+	ShaderLibrary library(compiler);
+	library.setVerbose(true);
+	Shader* fallback = library.get("vertexShader.glsl", "fallbackShader.glsl");
+	Shader* program = library.get("vertexShader.glsl", "fragmentShader.glsl");
+	if (program == NULL || fallback == NULL) return -1;
+	Shader &shader = *program;
+	TextureManager::Handle texture1 = residency.get("texture.jpeg", GL_RGB);
+	TextureManager::Handle texture2 = residency.get("awesomeface.png", GL_RGBA);
+
+	//The fallback is trivial to compile, wait for it so every frame draws something
+	if (fallback->finish()) configureShader(*fallback);
+	if (shader.isReady()) configureShader(shader);	//Loaded from the program cache
 
-	shader.use();
-	shader.setInt("texture1", 0);
-	//shader.setInt("texture2", 1);
-
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, texture1);
 	//glActiveTexture(GL_TEXTURE1);
-	//glBindTexture(GL_TEXTURE_2D, texture2);
+	//glBindTexture(GL_TEXTURE_2D, residency.use(texture2));
 
 	//============================================================
 	//Define transform
@@ -272,21 +674,47 @@ int main()
 	model = rotate(model, radians(0.0f), vec3(1.0f, 0.0f, 0.0f));
 	projection = perspective(radians(45.0f), SCR_WIDTH / SCR_HEIGHT, 0.1f, 100.0f);
 
-	unsigned int modelLoc = shader.setMatrix4("model", model);
-	unsigned int viewLoc = shader.setMatrix4("view", view);
-	unsigned int projectionLoc = shader.setMatrix4("projection", projection);
+	//Camera and object data come from uniform buffer blocks
+	UniformRing uniforms(64 * 1024);
+
+	Scene scene;
+	scene.shader = &shader;
+	scene.fallback = fallback;
+	scene.VAO = VAO;
+	scene.uniforms = &uniforms;
+	scene.textures = &residency;
+	scene.texture = texture1;
+	scene.model = model;
+	scene.projection = projection;
 
 	glEnable(GL_DEPTH_TEST);
 
-	POINT cursorPosition;
+	//glfwSwapInterval(1);					//Set interval
+	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);	//Set clear color
+
+	//============================================================
+	//Headless rendering
+	//============================================================
+	if (options.headless) {
+		//Captured frames should not show placeholders or the fallback
+		bool wasReady = shader.isReady();
+		compiler.finish();
+		if (!wasReady && shader.isReady()) configureShader(shader);
+		textures.finish();
+		residency.update();
+		return runHeadless(options, scene);
+	}
+
+	//Recompile shaders when their files are saved
+	library.setHotReload(true);
 
 	float yaw = 0;
 	float pitch = 0;
 	float offset = 500;
-	SetCursorPos((int)offset, (int)offset);
 
-	//glfwSwapInterval(1);					//Set interval
-	glClearColor(0.2f, 0.2f, 0.2f, 1.0f);	//Set clear color
+#ifdef _WIN32
+	POINT cursorPosition;
+	SetCursorPos((int)offset, (int)offset);
 
 	//============================================================
 	//Virtual sync
@@ -302,6 +730,11 @@ int main()
 
 	//Turn on virtual sync
 	if (wglSwapIntervalEXT != NULL) wglSwapIntervalEXT(0);
+#else
+	double cursorX, cursorY;
+	glfwSetCursorPos(window, offset, offset);
+	glfwSwapInterval(0);
+#endif
 
 
 	while (!glfwWindowShouldClose(window))
@@ -310,97 +743,193 @@ int main()
 		//Movement and rotation
 		//============================================================
 
+		{
+			PROFILE_ZONE("update");
+
+			//Calculate frame
+			float currentFrame = (float)glfwGetTime();
+			deltaTime = currentFrame - lastFrame;
+			lastFrame = currentFrame;
+
+			processInput(window);
+
+			//Collect programs the driver has finished, at most one per frame without
+			//GL_KHR_parallel_shader_compile, and set up the scene's once it links
+			bool wasReady = shader.isReady();
+			compiler.poll();
+			if (!wasReady && shader.isReady()) configureShader(shader);
+
+			//Swap in shaders that finished recompiling, upload decoded textures and stream evicted levels back in
+			library.update();
+			textures.update();
+			residency.update();
+
+			//Calculate mouse movement
+#ifdef _WIN32
+			GetCursorPos(&cursorPosition);
+			dx = cursorPosition.x - offset;
+			dy = offset - cursorPosition.y;
+			SetCursorPos((int)offset, (int)offset);
+#else
+			glfwGetCursorPos(window, &cursorX, &cursorY);
+			dx = (float)cursorX - offset;
+			dy = offset - (float)cursorY;
+			glfwSetCursorPos(window, offset, offset);
+#endif
+
+			//Calculate pitch and yaw
+			float sensitivity = 1.0f;
+			yaw += dx * sensitivity*deltaTime;
+			pitch += dy * sensitivity*deltaTime;
+			if (pitch > 89.9f) pitch = 89.9f;
+			if (pitch < -89.9f) pitch = -89.9f;
+
+			//Calculate front vector
+			glm::vec3 front;
+			front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+			front.y = sin(glm::radians(pitch));
+			front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+			cameraFront = glm::normalize(front);
+
+			//Implement gravity
+			vy -= 20 * deltaTime;
+			cameraPos.y += vy * deltaTime;
+			if (cameraPos.y < 0) {
+				cameraPos.y = 0;
+				vy = 0;
+			}
+
+			view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+		}
+
+		drawScene(scene, view);
 
-		//Calculate frame
-		float currentFrame = (float)glfwGetTime();
-		deltaTime = currentFrame - lastFrame;
-		lastFrame = currentFrame;
-
-		processInput(window);
-
-		//Calculate mouse movement
-		GetCursorPos(&cursorPosition);
-		dx = cursorPosition.x - offset;
-		dy = offset - cursorPosition.y;
-		SetCursorPos((int)offset, (int)offset);
-
-		//Calculate pitch and yaw
-		float sensitivity = 1.0f;
-		yaw += dx * sensitivity*deltaTime;
-		pitch += dy * sensitivity*deltaTime;
-		if (pitch > 89.9f) pitch = 89.9f;
-		if (pitch < -89.9f) pitch = -89.9f;
-
-		//Calculate front vector
-		glm::vec3 front;
-		front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-		front.y = sin(glm::radians(pitch));
-		front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-		cameraFront = glm::normalize(front);
-
-		//Implement gravity
-		vy -= 20 * deltaTime;
-		cameraPos.y += vy * deltaTime;
-		if (cameraPos.y < 0) {
-			cameraPos.y = 0;
-			vy = 0;
+		{
+			PROFILE_ZONE("swap");
+			glfwSwapBuffers(window);
+			glfwPollEvents();
 		}
 
-		view = glm::lookAt(cameraPos, cameraPos + cameraFront, cameraUp);
+		GpuProfiler::instance().endFrame();
+		Profiler::instance().endFrame();
+	}
 
-		//============================================================
-		//GPU associated part
-		//============================================================
+	return 0;
+}
 
-		//Graphic initialize Process
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);	//Clear
+int main(int argc, char** argv)
+{
+	Options options = parseOptions(argc, argv);
+	if (!options.benchDecode.empty()) return runDecodeBenchmark(options);
+	if (!options.convertInput.empty()) return runConvert(options);
+	if (!options.benchEncode.empty()) return runEncodeBenchmark(options);
+	if (!options.benchMips.empty()) return runMipBenchmark(options);
+	Profiler::instance().setThreadName("main");
+	if (!options.tracePath.empty()) Profiler::instance().startCapture();
+
+	//Large JPEGs split their restart intervals across this pool. The hook is global, so it
+	//is installed once here with a pool that outlives every decode.
+	ThreadPool decodePool;
+	stbi_set_parallel_for(decodeParallelFor, &decodePool);
 
-		//Use shader
-		shader.use();
+	log("Starting...");
+	GLFWwindow* window = init((int)SCR_WIDTH, (int)SCR_HEIGHT, options.headless);
+	if (window == NULL) {
+		stbi_set_parallel_for(NULL, NULL);
+		return -1;
+	}
 
-		//Update position and rotation
+	//Add resize callback
+	glfwSetFramebufferSizeCallback(window, framebuffer_size_callback);
 
-		//shader.updateMatrix4(modelLoc, model);
-		shader.updateMatrix4(viewLoc, view);
+	GpuProfiler::instance().initialize();
 
-		//Update buffer change
-		//glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+	//============================================================
+	//Define vertex
+	//============================================================
 
-		//============================================================
-		//Drawing process
-		//============================================================
+	//New vertex
+	float vertices[] = {
+			-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
+			 0.5f, -0.5f, -0.5f,  1.0f, 0.0f,
+			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+			-0.5f, -0.5f, -0.5f,  0.0f, 0.0f,
 
-		glBindVertexArray(VAO);
+			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+			 0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+			 0.5f,  0.5f,  0.5f,  1.0f, 1.0f,
+			-0.5f,  0.5f,  0.5f,  0.0f, 1.0f,
+			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
 
-		//Position attribute
-		glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(0 * sizeof(float)));
-		glEnableVertexAttribArray(0);
+			-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+			-0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+			-0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
 
-		//Textrue attribute
-		glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
-		glEnableVertexAttribArray(1);
+			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+			 0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+			 0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+			 0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
 
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
+			 0.5f, -0.5f, -0.5f,  1.0f, 1.0f,
+			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+			 0.5f, -0.5f,  0.5f,  1.0f, 0.0f,
+			-0.5f, -0.5f,  0.5f,  0.0f, 0.0f,
+			-0.5f, -0.5f, -0.5f,  0.0f, 1.0f,
 
-		//Uncommenet here swhen use element buffer object
-		//Primitive types, array start inex, number of vertex(3 for triangles)
-		//glDrawElements(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0);
+			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f,
+			 0.5f,  0.5f, -0.5f,  1.0f, 1.0f,
+			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+			 0.5f,  0.5f,  0.5f,  1.0f, 0.0f,
+			-0.5f,  0.5f,  0.5f,  0.0f, 0.0f,
+			-0.5f,  0.5f, -0.5f,  0.0f, 1.0f
+	};
+
+	//Vertex buffer object
+	unsigned int VBO;					//Buffer id
+	glGenBuffers(1, &VBO);				//Get buffer
+	glBindBuffer(GL_ARRAY_BUFFER, VBO);	//Bind buffer
 
-		//Release resource
-		glBindVertexArray(0);
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
+	//Veretex array object
+	unsigned int VAO;					//Array id
+	glGenVertexArrays(1, &VAO);			//Get array
+	glBindVertexArray(VAO);				//Bind array
 
-		shader.stop();
+	//Initialze code
+	glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
 
-		glfwSwapBuffers(window);
-		glfwPollEvents();
-	}
+	//Element buffer object
+	//unsigned int EBO;
+	//glGenBuffers(1, &EBO);
+	//glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+	//glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices, GL_STATIC_DRAW);
+
+	//Position attribute
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(0 * sizeof(float)));
+	glEnableVertexAttribArray(0);
+
+	//Textrue attribute
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+	glEnableVertexAttribArray(1);
+
+	int result = runScene(options, window, VAO);
 
 	glDeleteVertexArrays(1, &VAO);
 	glDeleteBuffers(1, &VBO);
 	//glDeleteBuffers(1, &EBO);
+	GpuProfiler::instance().shutdown();
+
+	writeProfile(options.tracePath);
 
 	glfwTerminate();
-	return 0;
+	stbi_set_parallel_for(NULL, NULL);
+	return result;
 }
\ No newline at end of file
@@ -1,2 +1,11 @@
+//stb_image allocates through the arena, so repeated decodes reuse their buffers.
+//The images it returns are taken out of the arena first.
+//Memory from stbi_load and friends must be freed with stbi_image_free.
+#include "ImageArena.h"
+#define STBI_MALLOC(size) ImageArena::allocate(size)
+#define STBI_REALLOC(block, size) ImageArena::reallocate(block, size)
+#define STBI_FREE(block) ImageArena::release(block)
+#define STBI_RESULT(block, size) ImageArena::detach(block, size)
+
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
\ No newline at end of file
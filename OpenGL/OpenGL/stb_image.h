@@ -14,6 +14,8 @@
 
    You can #define STBI_ASSERT(x) before the #include to avoid using assert.h.
    And #define STBI_MALLOC, STBI_REALLOC, and STBI_FREE to avoid using malloc,realloc,free
+   and STBI_RESULT(p,sz) to see every image before it is returned, e.g. to move it out
+   of a pool the decoder allocates from; it returns the pointer to hand out.
 
 
    QUICK NOTES:
@@ -159,7 +161,9 @@ RECENT REVISION HISTORY:
 // stbi_failure_reason() can be queried for an extremely brief, end-user
 // unfriendly explanation of why the load failed. Define STBI_NO_FAILURE_STRINGS
 // to avoid compiling these strings at all, and STBI_FAILURE_USERMSG to get slightly
-// more user-friendly ones.
+// more user-friendly ones. The reason is kept per thread, so decodes running on
+// several threads at once each see their own; define STBI_NO_THREAD_LOCALS to
+// share one.
 //
 // Paletted PNG, BMP, GIF, and PIC images are automatically depalettized.
 //
@@ -382,6 +386,58 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
 #endif
 
+// load at 1/scale of the size in each direction, rounded up, for scale 1, 2, 4
+// or 8. JPEGs are scaled while decoding with reduced inverse DCTs, so e.g. a 1/8
+// preview only needs the DC term of each block and costs a fraction of a full
+// decode. other formats are decoded in full and box filtered.
+STBIDEF stbi_uc *stbi_load_scaled_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+STBIDEF stbi_uc *stbi_load_scaled_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_scaled               (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int scale);
+#endif
+
+// decode without returning the image: rows are handed to a callback as they're
+// converted, in bands of up to a few dozen rows, so a huge image can be tiled or
+// uploaded without ever being held whole. region is { x, y, w, h } in the output
+// image, or NULL for all of it; y and pixels then refer to the region. pixels is
+// only valid during the call, and rows are stride bytes apart (stride is negative
+// when flipping on load). return 0 from the callback to stop decoding. returns 1
+// on success, with the size of the whole image in *x and *y.
+//
+// baseline JPEGs are decoded a row of MCUs at a time, keeping two rows of them,
+// and decoding stops after the region's last row. progressive JPEGs keep the
+// coefficients of the whole image, and other formats are decoded in full first.
+typedef int stbi_rows_callback(void *user, int y, int rows, stbi_uc const *pixels, int stride);
+STBIDEF int stbi_load_rows_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, int const *region, stbi_rows_callback *callback, void *user);
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, int const *region, stbi_rows_callback *callback, void *callback_user);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_rows               (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, int const *region, stbi_rows_callback *callback, void *user);
+#endif
+
+// decode straight into caller memory, e.g. a mapped pixel buffer: row y goes to
+// dest + y*dest_stride. the image has to fit in dest_h rows of dest_stride bytes,
+// so get its size from stbi_info first. returns 1 on success. works like
+// stbi_load_rows, so a baseline JPEG is never held whole in between.
+STBIDEF int stbi_load_into_from_memory   (stbi_uc           const *buffer, int len   , stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *channels_in_file, int desired_channels);
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk  , void *user, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *channels_in_file, int desired_channels);
+#ifndef STBI_NO_STDIO
+STBIDEF int stbi_load_into               (char const *filename, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *channels_in_file, int desired_channels);
+#endif
+
+// load like stbi_load, but show progressive JPEGs as they refine: before each scan
+// after the first, the image the scans so far make is converted like the result
+// and handed to the callback, so a streamed texture can appear blurry at once and
+// sharpen. scans counts the scans in it; pixels is only valid during the call.
+// every preview costs about as much as the color conversion and inverse DCTs of a
+// full decode. return 0 from the callback to stop decoding, which fails with
+// "stopped". other images are loaded without calling it.
+typedef int stbi_scan_callback(void *user, int scans, stbi_uc const *pixels, int w, int h, int channels);
+STBIDEF stbi_uc *stbi_load_progressive_from_memory   (stbi_uc           const *buffer, int len   , int *x, int *y, int *channels_in_file, int desired_channels, stbi_scan_callback *callback, void *user);
+STBIDEF stbi_uc *stbi_load_progressive_from_callbacks(stbi_io_callbacks const *clbk  , void *user, int *x, int *y, int *channels_in_file, int desired_channels, stbi_scan_callback *callback, void *callback_user);
+#ifndef STBI_NO_STDIO
+STBIDEF stbi_uc *stbi_load_progressive               (char const *filename, int *x, int *y, int *channels_in_file, int desired_channels, stbi_scan_callback *callback, void *user);
+#endif
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -433,7 +489,7 @@ STBIDEF int      stbi_is_hdr_from_file(FILE *f);
 
 
 // get a VERY brief reason for failure
-// NOT THREADSAFE
+// per thread, see STBI_NO_THREAD_LOCALS
 STBIDEF const char *stbi_failure_reason  (void);
 
 // free the loaded image -- this is just free()
@@ -444,6 +500,8 @@ STBIDEF int      stbi_info_from_memory(stbi_uc const *buffer, int len, int *x, i
 STBIDEF int      stbi_info_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp);
 STBIDEF int      stbi_is_16_bit_from_memory(stbi_uc const *buffer, int len);
 STBIDEF int      stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *clbk, void *user);
+// 1 for progressive JPEGs, which stbi_load_progressive can show scan by scan
+STBIDEF int      stbi_is_progressive_from_memory(stbi_uc const *buffer, int len);
 
 #ifndef STBI_NO_STDIO
 STBIDEF int      stbi_info               (char const *filename,     int *x, int *y, int *comp);
@@ -466,6 +524,29 @@ STBIDEF void stbi_convert_iphone_png_to_rgb(int flag_true_if_should_convert);
 // flip the image vertically, so the first pixel in the output array is the bottom left
 STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip);
 
+// run decoding work on several threads. the function must call task(task_data, i)
+// for every i in [0,count), in any order and possibly concurrently, and return once
+// all calls have finished. used for baseline JPEGs with restart intervals loaded
+// from memory, and for JPEG color conversion. NULL (default) decodes serially.
+typedef void stbi_parallel_task(void *task_data, int index);
+typedef void stbi_parallel_for(void *context, int count, stbi_parallel_task *task, void *task_data);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *func, void *context);
+
+// cap the SIMD kernels used to decode JPEGs and PNGs, e.g. to benchmark them
+// against each other or to rule one out when chasing a decoding problem. the
+// best kernels the CPU supports up to max_level are used; the default allows
+// all of them. the levels produce identical pixels. STBI_simd_sse2 also stands
+// for NEON, which only has JPEG kernels.
+enum
+{
+   STBI_simd_none = 0,
+   STBI_simd_sse2 = 1,
+   STBI_simd_avx2 = 2
+};
+STBIDEF void stbi_set_simd_level(int max_level);
+// the level decoding actually uses on this CPU
+STBIDEF int  stbi_get_simd_level(void);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -568,12 +649,14 @@ typedef unsigned short stbi__uint16;
 typedef   signed short stbi__int16;
 typedef unsigned int   stbi__uint32;
 typedef   signed int   stbi__int32;
+typedef unsigned __int64 stbi__uint64;
 #else
 #include <stdint.h>
 typedef uint16_t stbi__uint16;
 typedef int16_t  stbi__int16;
 typedef uint32_t stbi__uint32;
 typedef int32_t  stbi__int32;
+typedef uint64_t stbi__uint64;
 #endif
 
 // should produce compiler error if size is wrong
@@ -613,6 +696,10 @@ typedef unsigned char validate_uint32[sizeof(stbi__uint32)==4 ? 1 : -1];
 #define STBI_REALLOC_SIZED(p,oldsz,newsz) STBI_REALLOC(p,newsz)
 #endif
 
+#ifndef STBI_RESULT
+#define STBI_RESULT(p,sz)         (p)
+#endif
+
 // x86/x64 detection
 #if defined(__x86_64__) || defined(_M_X64)
 #define STBI__X64_TARGET
@@ -675,7 +762,7 @@ static int stbi__cpuid3(void)
 
 #define STBI_SIMD_ALIGN(type, name) __declspec(align(16)) type name
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    int info3 = stbi__cpuid3();
@@ -686,7 +773,7 @@ static int stbi__sse2_available(void)
 #else // assume GCC-style if not VC++
 #define STBI_SIMD_ALIGN(type, name) type name __attribute__((aligned(16)))
 
-#if !defined(STBI_NO_JPEG) && defined(STBI_SSE2)
+#if !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG)) && defined(STBI_SSE2)
 static int stbi__sse2_available(void)
 {
    // If we're even attempting to compile this on GCC/Clang, that means
@@ -696,6 +783,62 @@ static int stbi__sse2_available(void)
 }
 #endif
 
+#endif
+
+// AVX2 kernels are built next to the SSE2 ones and picked at runtime, so the
+// same binary still runs on CPUs without AVX2. #define STBI_NO_AVX2 to leave
+// them out, e.g. for compilers that can't target AVX2 per function.
+#if !defined(STBI_NO_AVX2) && !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG)) && \
+    ((defined(_MSC_VER) && _MSC_VER >= 1700) || (defined(__GNUC__) && (__GNUC__ >= 5 || defined(__clang__))))
+#define STBI_AVX2
+#include <immintrin.h>
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// VC++ lets any function use AVX2 intrinsics
+#define STBI__AVX2_TARGET
+static void stbi__cpuid(int info[4], int leaf)
+{
+   __cpuidex(info, leaf, 0);
+}
+
+static unsigned int stbi__xgetbv0(void)
+{
+   return (unsigned int) _xgetbv(0);
+}
+#else
+#include <cpuid.h>
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static void stbi__cpuid(int info[4], int leaf)
+{
+   unsigned int a,b,c,d;
+   __cpuid_count(leaf, 0, a, b, c, d);
+   info[0] = (int) a;
+   info[1] = (int) b;
+   info[2] = (int) c;
+   info[3] = (int) d;
+}
+
+static unsigned int stbi__xgetbv0(void)
+{
+   unsigned int eax, edx;
+   __asm__ __volatile__("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+   return eax;
+}
+#endif
+
+static int stbi__avx2_available(void)
+{
+   int info[4];
+   stbi__cpuid(info, 0);
+   if (info[0] < 7) return 0;
+   // OSXSAVE and AVX, so xgetbv exists...
+   stbi__cpuid(info, 1);
+   if ((info[2] & (3 << 27)) != (3 << 27)) return 0;
+   // ...and the OS saves the xmm and ymm registers
+   if ((stbi__xgetbv0() & 6) != 6) return 0;
+   stbi__cpuid(info, 7);
+   return (info[1] >> 5) & 1;
+}
 #endif
 #endif
 
@@ -734,6 +877,10 @@ typedef struct
 
    stbi_uc *img_buffer, *img_buffer_end;
    stbi_uc *img_buffer_original, *img_buffer_original_end;
+
+   int scale_shift; // stbi_load_scaled; decoders that scale while decoding clear it
+   stbi_scan_callback *scan_callback; // stbi_load_progressive
+   void *scan_user;
 } stbi__context;
 
 
@@ -744,6 +891,8 @@ static void stbi__start_mem(stbi__context *s, stbi_uc const *buffer, int len)
 {
    s->io.read = NULL;
    s->read_from_callbacks = 0;
+   s->scale_shift = 0;
+   s->scan_callback = NULL;
    s->img_buffer = s->img_buffer_original = (stbi_uc *) buffer;
    s->img_buffer_end = s->img_buffer_original_end = (stbi_uc *) buffer+len;
 }
@@ -755,6 +904,8 @@ static void stbi__start_callbacks(stbi__context *s, stbi_io_callbacks *c, void *
    s->io_user_data = user;
    s->buflen = sizeof(s->buffer_start);
    s->read_from_callbacks = 1;
+   s->scale_shift = 0;
+   s->scan_callback = NULL;
    s->img_buffer_original = s->buffer_start;
    stbi__refill_buffer(s);
    s->img_buffer_original_end = s->img_buffer_end;
@@ -813,10 +964,25 @@ typedef struct
    int bits_per_channel;
    int num_channels;
    int channel_order;
+   int flipped;         // the loader already wrote the rows bottom-up for stbi__vertically_flip_on_load
 } stbi__result_info;
 
+// stbi_load_rows request
+typedef struct
+{
+   stbi_rows_callback *callback;
+   void *user;
+   stbi_uc *dest;       // stbi_load_into, instead of the callback
+   int dest_stride, dest_h;
+   int req_comp;
+   int const *region;
+   int x0, y0, x1, y1;  // region clipped to the output image
+   int n;               // output channels
+} stbi__rows;
+
 #ifndef STBI_NO_JPEG
 static int      stbi__jpeg_test(stbi__context *s);
+static int      stbi__jpeg_load_rows(stbi__context *s, int *x, int *y, int *comp, stbi__rows *rows);
 static void    *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri);
 static int      stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
@@ -872,8 +1038,24 @@ static void    *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int
 static int      stbi__pnm_info(stbi__context *s, int *x, int *y, int *comp);
 #endif
 
+#ifndef STBI_NO_THREAD_LOCALS
+   #if defined(__cplusplus) && __cplusplus >= 201103L
+      #define STBI_THREAD_LOCAL       thread_local
+   #elif defined(_MSC_VER)
+      #define STBI_THREAD_LOCAL       __declspec(thread)
+   #elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+      #define STBI_THREAD_LOCAL       _Thread_local
+   #elif defined(__GNUC__)
+      #define STBI_THREAD_LOCAL       __thread
+   #endif
+#endif
+
+#ifdef STBI_THREAD_LOCAL
+static STBI_THREAD_LOCAL const char *stbi__g_failure_reason;
+#else
 // this is not threadsafe
 static const char *stbi__g_failure_reason;
+#endif
 
 STBIDEF const char *stbi_failure_reason(void)
 {
@@ -1001,6 +1183,59 @@ STBIDEF void stbi_set_flip_vertically_on_load(int flag_true_if_should_flip)
     stbi__vertically_flip_on_load = flag_true_if_should_flip;
 }
 
+static stbi_parallel_for *stbi__parallel_for_func = NULL;
+static void *stbi__parallel_for_context = NULL;
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *func, void *context)
+{
+   stbi__parallel_for_func = func;
+   stbi__parallel_for_context = context;
+}
+
+static int stbi__simd_max_level = STBI_simd_avx2;
+
+STBIDEF void stbi_set_simd_level(int max_level)
+{
+   stbi__simd_max_level = max_level;
+}
+
+STBIDEF int stbi_get_simd_level(void)
+{
+   int level = STBI_simd_none;
+#if defined(STBI_SSE2) && !(defined(STBI_NO_JPEG) && defined(STBI_NO_PNG))
+   if (stbi__sse2_available()) level = STBI_simd_sse2;
+#endif
+#ifdef STBI_NEON
+   level = STBI_simd_sse2;
+#endif
+#ifdef STBI_AVX2
+   if (level == STBI_simd_sse2 && stbi__avx2_available()) level = STBI_simd_avx2;
+#endif
+   return level < stbi__simd_max_level ? level : stbi__simd_max_level;
+}
+
+// failure flag the tasks of one stbi__parallel call may all set at once
+#if defined(__cplusplus) && (__cplusplus >= 201103L || (defined(_MSC_VER) && _MSC_VER >= 1900))
+#include <atomic>
+typedef std::atomic<int> stbi__task_flag;
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_ATOMICS__)
+#include <stdatomic.h>
+typedef atomic_int stbi__task_flag;
+#else
+typedef volatile int stbi__task_flag;
+#endif
+
+// run task over [0,count), on the parallel hook when one is set
+static void stbi__parallel(int count, stbi_parallel_task *task, void *task_data)
+{
+   int i;
+   if (stbi__parallel_for_func && count > 1)
+      stbi__parallel_for_func(stbi__parallel_for_context, count, task, task_data);
+   else
+      for (i=0; i < count; ++i)
+         task(task_data, i);
+}
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1132,12 +1367,12 @@ static unsigned char *stbi__load_and_postprocess_8bit(stbi__context *s, int *x,
 
    // @TODO: move stbi__convert_format to here
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
    }
 
-   return (unsigned char *) result;
+   return (unsigned char *) STBI_RESULT(result, (size_t) *x * *y * (req_comp ? req_comp : *comp));
 }
 
 static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x, int *y, int *comp, int req_comp)
@@ -1157,12 +1392,12 @@ static stbi__uint16 *stbi__load_and_postprocess_16bit(stbi__context *s, int *x,
    // @TODO: move stbi__convert_format16 to here
    // @TODO: special case RGB-to-Y (and RGBA-to-YA) for 8-bit-to-16-bit case to keep more precision
 
-   if (stbi__vertically_flip_on_load) {
+   if (stbi__vertically_flip_on_load && !ri.flipped) {
       int channels = req_comp ? req_comp : *comp;
       stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi__uint16));
    }
 
-   return (stbi__uint16 *) result;
+   return (stbi__uint16 *) STBI_RESULT(result, (size_t) *x * *y * (req_comp ? req_comp : *comp) * sizeof(stbi__uint16));
 }
 
 #if !defined(STBI_NO_HDR) && !defined(STBI_NO_LINEAR)
@@ -1175,6 +1410,128 @@ static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, in
 }
 #endif
 
+// shrink an 8-bit image by 1<<shift in each direction, averaging each block of
+// pixels; blocks on the right and bottom edges may be partial
+static stbi_uc *stbi__downscale_box(stbi_uc *img, int *x, int *y, int n, int shift)
+{
+   int i,j,k,u,v;
+   int w = *x, h = *y, size = 1 << shift;
+   int ow = (w + size - 1) >> shift, oh = (h + size - 1) >> shift;
+   stbi_uc *out = (stbi_uc *) stbi__malloc_mad3(n, ow, oh, 0);
+   if (!out) { STBI_FREE(img); return stbi__errpuc("outofmem", "Out of memory"); }
+   for (j=0; j < oh; ++j) {
+      int y0 = j << shift, y1 = y0 + size < h ? y0 + size : h;
+      for (i=0; i < ow; ++i) {
+         int x0 = i << shift, x1 = x0 + size < w ? x0 + size : w;
+         int count = (x1 - x0) * (y1 - y0);
+         for (k=0; k < n; ++k) {
+            int sum = 0;
+            for (v=y0; v < y1; ++v)
+               for (u=x0; u < x1; ++u)
+                  sum += img[((size_t) v * w + u) * n + k];
+            out[((size_t) j * ow + i) * n + k] = (stbi_uc) ((sum + count/2) / count);
+         }
+      }
+   }
+   STBI_FREE(img);
+   *x = ow;
+   *y = oh;
+   return out;
+}
+
+static stbi_uc *stbi__load_scaled(stbi__context *s, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   stbi_uc *result;
+   switch (scale) {
+      case 1: s->scale_shift = 0; break;
+      case 2: s->scale_shift = 1; break;
+      case 4: s->scale_shift = 2; break;
+      case 8: s->scale_shift = 3; break;
+      default: return stbi__errpuc("bad scale", "Scale must be 1, 2, 4 or 8");
+   }
+   result = stbi__load_and_postprocess_8bit(s,x,y,comp,req_comp);
+   if (result && s->scale_shift)
+      result = stbi__downscale_box(result, x, y, req_comp ? req_comp : *comp, s->scale_shift);
+   return result;
+}
+
+static void stbi__rows_init(stbi__rows *rows, int req_comp, int const *region, stbi_rows_callback *callback, void *user)
+{
+   rows->callback = callback;
+   rows->user = user;
+   rows->dest = NULL;
+   rows->req_comp = req_comp;
+   rows->region = region;
+}
+
+// clip the requested region to a w x h image with n channels
+static int stbi__rows_region(stbi__rows *rows, int w, int h, int n)
+{
+   int const *region = rows->region;
+   rows->x0 = 0; rows->y0 = 0;
+   rows->x1 = w; rows->y1 = h;
+   rows->n = n;
+   if (region) {
+      if (region[0] > rows->x0) rows->x0 = region[0];
+      if (region[1] > rows->y0) rows->y0 = region[1];
+      if (region[2] < rows->x1 - region[0]) rows->x1 = region[0] + region[2];
+      if (region[3] < rows->y1 - region[1]) rows->y1 = region[1] + region[3];
+   }
+   if (rows->x0 >= rows->x1 || rows->y0 >= rows->y1) return stbi__err("bad region", "Region outside the image");
+   if (rows->dest && ((rows->x1 - rows->x0) * n > rows->dest_stride || rows->y1 - rows->y0 > rows->dest_h))
+      return stbi__err("too small", "Image larger than the destination");
+   return 1;
+}
+
+// hand over rows y..y+count-1 of the region
+static int stbi__rows_deliver(stbi__rows *rows, int y, int count, stbi_uc const *pixels, int stride)
+{
+   if (rows->dest) {
+      int i, size = (rows->x1 - rows->x0) * rows->n;
+      for (i=0; i < count; ++i)
+         memcpy(rows->dest + (size_t) (y + i) * rows->dest_stride, pixels + (ptrdiff_t) i * stride, size);
+      return 1;
+   }
+   return rows->callback(rows->user, y, count, pixels, stride) ? 1 : stbi__err("stopped", "Stopped by the callback");
+}
+
+static int stbi__load_rows(stbi__context *s, int *x, int *y, int *comp, stbi__rows *rows)
+{
+   stbi_uc *result;
+   int ok;
+
+   #ifndef STBI_NO_JPEG
+   if (stbi__jpeg_test(s)) return stbi__jpeg_load_rows(s, x, y, comp, rows);
+   #endif
+
+   result = stbi__load_and_postprocess_8bit(s,x,y,comp,rows->req_comp);
+   if (!result) return 0;
+   ok = stbi__rows_region(rows, *x, *y, rows->req_comp ? rows->req_comp : *comp);
+   if (ok) {
+      stbi_uc *first = result + ((size_t) rows->y0 * *x + rows->x0) * rows->n;
+      ok = stbi__rows_deliver(rows, 0, rows->y1 - rows->y0, first, *x * rows->n);
+   }
+   STBI_FREE(result);
+   return ok;
+}
+
+static stbi_uc *stbi__load_progressive(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_scan_callback *callback, void *user)
+{
+   s->scan_callback = callback;
+   s->scan_user = user;
+   return stbi__load_and_postprocess_8bit(s,x,y,comp,req_comp);
+}
+
+static int stbi__load_into(stbi__context *s, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__rows rows;
+   stbi__rows_init(&rows, req_comp, NULL, NULL, NULL);
+   rows.dest = dest;
+   rows.dest_stride = dest_stride;
+   rows.dest_h = dest_h;
+   return stbi__load_rows(s, x, y, comp, &rows);
+}
+
 #ifndef STBI_NO_STDIO
 
 #if defined(_MSC_VER) && defined(STBI_WINDOWS_UTF8)
@@ -1264,6 +1621,56 @@ STBIDEF stbi_us *stbi_load_16(char const *filename, int *x, int *y, int *comp, i
    return result;
 }
 
+STBIDEF stbi_uc *stbi_load_scaled(char const *filename, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__context s;
+   unsigned char *result;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_scaled(&s,x,y,comp,req_comp,scale);
+   fclose(f);
+   return result;
+}
+
+STBIDEF int stbi_load_rows(char const *filename, int *x, int *y, int *comp, int req_comp, int const *region, stbi_rows_callback *callback, void *user)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__context s;
+   stbi__rows rows;
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   stbi__rows_init(&rows, req_comp, region, callback, user);
+   result = stbi__load_rows(&s,x,y,comp,&rows);
+   fclose(f);
+   return result;
+}
+
+STBIDEF int stbi_load_into(char const *filename, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *comp, int req_comp)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__context s;
+   int result;
+   if (!f) return stbi__err("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_into(&s,dest,dest_stride,dest_h,x,y,comp,req_comp);
+   fclose(f);
+   return result;
+}
+
+STBIDEF stbi_uc *stbi_load_progressive(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_scan_callback *callback, void *user)
+{
+   FILE *f = stbi__fopen(filename, "rb");
+   stbi__context s;
+   unsigned char *result;
+   if (!f) return stbi__errpuc("can't fopen", "Unable to open file");
+   stbi__start_file(&s,f);
+   result = stbi__load_progressive(&s,x,y,comp,req_comp,callback,user);
+   fclose(f);
+   return result;
+}
+
 
 #endif //!STBI_NO_STDIO
 
@@ -1295,6 +1702,66 @@ STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *u
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_scaled_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_scaled(&s,x,y,comp,req_comp,scale);
+}
+
+STBIDEF stbi_uc *stbi_load_scaled_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, int scale)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_scaled(&s,x,y,comp,req_comp,scale);
+}
+
+STBIDEF int stbi_load_rows_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int const *region, stbi_rows_callback *callback, void *user)
+{
+   stbi__context s;
+   stbi__rows rows;
+   stbi__start_mem(&s,buffer,len);
+   stbi__rows_init(&rows, req_comp, region, callback, user);
+   return stbi__load_rows(&s,x,y,comp,&rows);
+}
+
+STBIDEF int stbi_load_rows_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, int const *region, stbi_rows_callback *callback, void *callback_user)
+{
+   stbi__context s;
+   stbi__rows rows;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   stbi__rows_init(&rows, req_comp, region, callback, callback_user);
+   return stbi__load_rows(&s,x,y,comp,&rows);
+}
+
+STBIDEF int stbi_load_into_from_memory(stbi_uc const *buffer, int len, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_into(&s,dest,dest_stride,dest_h,x,y,comp,req_comp);
+}
+
+STBIDEF int stbi_load_into_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_uc *dest, int dest_stride, int dest_h, int *x, int *y, int *comp, int req_comp)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_into(&s,dest,dest_stride,dest_h,x,y,comp,req_comp);
+}
+
+STBIDEF stbi_uc *stbi_load_progressive_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_scan_callback *callback, void *user)
+{
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   return stbi__load_progressive(&s,x,y,comp,req_comp,callback,user);
+}
+
+STBIDEF stbi_uc *stbi_load_progressive_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, stbi_scan_callback *callback, void *callback_user)
+{
+   stbi__context s;
+   stbi__start_callbacks(&s, (stbi_io_callbacks *) clbk, user);
+   return stbi__load_progressive(&s,x,y,comp,req_comp,callback,callback_user);
+}
+
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp)
 {
@@ -1307,7 +1774,12 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
       stbi__vertical_flip_slices( result, *x, *y, *z, *comp ); 
    }
 
-   return result; 
+   if (result) {
+      // frames are 4 channels unless converted to req_comp
+      result = (unsigned char *) STBI_RESULT(result, (size_t) *x * *y * *z * (req_comp ? req_comp : 4));
+      if (delays && *delays) *delays = (int *) STBI_RESULT(*delays, (size_t) *z * sizeof(int));
+   }
+   return result;
 }
 #endif
 
@@ -1319,14 +1791,18 @@ static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int
    if (stbi__hdr_test(s)) {
       stbi__result_info ri;
       float *hdr_data = stbi__hdr_load(s,x,y,comp,req_comp, &ri);
-      if (hdr_data)
+      if (hdr_data) {
          stbi__float_postprocess(hdr_data,x,y,comp,req_comp);
+         hdr_data = (float *) STBI_RESULT(hdr_data, (size_t) *x * *y * (req_comp ? req_comp : *comp) * sizeof(float));
+      }
       return hdr_data;
    }
    #endif
    data = stbi__load_and_postprocess_8bit(s, x, y, comp, req_comp);
-   if (data)
-      return stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+   if (data) {
+      float *hdr_data = stbi__ldr_to_hdr(data, *x, *y, req_comp ? req_comp : *comp);
+      return hdr_data ? (float *) STBI_RESULT(hdr_data, (size_t) *x * *y * (req_comp ? req_comp : *comp) * sizeof(float)) : NULL;
+   }
    return stbi__errpf("unknown image type", "Image not of any known type, or corrupt");
 }
 
@@ -1578,9 +2054,12 @@ static stbi_uc stbi__compute_y(int r, int g, int b)
    return (stbi_uc) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+// with ri, the conversion also does the flip of stbi__vertically_flip_on_load
+// and records it there, so the output is only written once
+static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
 {
    int i,j;
+   int flip = ri && stbi__vertically_flip_on_load;
    unsigned char *good;
 
    if (req_comp == img_n) return data;
@@ -1594,7 +2073,7 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
 
    for (j=0; j < (int) y; ++j) {
       unsigned char *src  = data + j * x * img_n   ;
-      unsigned char *dest = good + j * x * req_comp;
+      unsigned char *dest = good + (flip ? (int) y-1-j : j) * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1618,6 +2097,7 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
       #undef STBI__CASE
    }
 
+   if (flip) ri->flipped = 1;
    STBI_FREE(data);
    return good;
 }
@@ -1627,9 +2107,10 @@ static stbi__uint16 stbi__compute_y_16(int r, int g, int b)
    return (stbi__uint16) (((r*77) + (g*150) +  (29*b)) >> 8);
 }
 
-static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y)
+static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int req_comp, unsigned int x, unsigned int y, stbi__result_info *ri)
 {
    int i,j;
+   int flip = ri && stbi__vertically_flip_on_load;
    stbi__uint16 *good;
 
    if (req_comp == img_n) return data;
@@ -1643,7 +2124,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    for (j=0; j < (int) y; ++j) {
       stbi__uint16 *src  = data + j * x * img_n   ;
-      stbi__uint16 *dest = good + j * x * req_comp;
+      stbi__uint16 *dest = good + (flip ? (int) y-1-j : j) * x * req_comp;
 
       #define STBI__COMBO(a,b)  ((a)*8+(b))
       #define STBI__CASE(a,b)   case STBI__COMBO(a,b): for(i=x-1; i >= 0; --i, src += a, dest += b)
@@ -1667,6 +2148,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
       #undef STBI__CASE
    }
 
+   if (flip) ri->flipped = 1;
    STBI_FREE(data);
    return good;
 }
@@ -1810,11 +2292,32 @@ typedef struct
 
    int scan_n, order[4];
    int restart_interval, todo;
+   int scale_shift;  // decoding at 1/(1<<scale_shift) size
 
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
    stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+   // optional; transforms two blocks at once, see stbi__jpeg_idct
+   void (*idct_block2_kernel)(stbi_uc *out0, int out_stride0, short *data0, stbi_uc *out1, int out_stride1, short *data1);
+
+// block waiting for a partner for idct_block2_kernel
+   short idct_pending[64];
+   stbi_uc *idct_pending_out;
+   int idct_pending_stride;
+
+// stbi_load_rows
+   struct stbi__jpeg_rows *rows;
+   int band;         // planes hold two mcu rows, converted as they're decoded
+   int band_mcu_y;   // mcu row in the top half of the planes
+   int idct_skip;    // blocks above the region that no output row reads
+   int rows_done;    // region delivered, stop decoding
+
+// stbi_load_progressive
+   stbi_scan_callback *scan_callback;
+   void *scan_user;
+   int scans;        // scans started so far
+   int req_comp;
 } stbi__jpeg;
 
 static int stbi__build_huffman(stbi__huffman *h, int *count)
@@ -2326,6 +2829,92 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced inverse transforms for scaled decoding, after the ones in the IJG's
+// jidctred.c. each computes an NxN block straight from the low frequency
+// coefficients, which is much cheaper than transforming 8x8 and averaging.
+// 4x4 and 2x2 drop the coefficients an output of that size can't represent;
+// 1x1 is just the DC term.
+#define STBI__IDCT_4_ODD(z1,z2,z3,z4) \
+   t0 = (z1) * stbi__f2f(-0.211164243) + (z2) * stbi__f2f( 1.451774981) \
+      + (z3) * stbi__f2f(-2.172734803) + (z4) * stbi__f2f( 1.061594337); \
+   t2 = (z1) * stbi__f2f(-0.509795579) + (z2) * stbi__f2f(-0.601344887) \
+      + (z3) * stbi__f2f( 0.899976223) + (z4) * stbi__f2f( 2.562915447);
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,val[32],*v=val;
+   stbi_uc *o;
+   short *d = data;
+
+   // columns; column 4 isn't needed by the rows
+   for (i=0; i < 8; ++i,++d, ++v) {
+      int t0,t2,dc,ev;
+      if (i == 4) continue;
+      if (d[ 8]==0 && d[16]==0 && d[24]==0 && d[40]==0 && d[48]==0 && d[56]==0) {
+         int dcterm = d[0]*4;
+         v[0] = v[8] = v[16] = v[24] = dcterm;
+         continue;
+      }
+      dc = stbi__fsh(d[0]) * 2;
+      ev = d[16] * stbi__f2f(1.847759065) - d[48] * stbi__f2f(0.765366865);
+      STBI__IDCT_4_ODD(d[56], d[40], d[24], d[8])
+      dc += 1024;
+      v[ 0] = (dc + ev + t2) >> 11;
+      v[24] = (dc + ev - t2) >> 11;
+      v[ 8] = (dc - ev + t0) >> 11;
+      v[16] = (dc - ev - t0) >> 11;
+   }
+
+   for (i=0, v=val, o=out; i < 4; ++i,v+=8,o+=out_stride) {
+      int t0,t2,dc,ev;
+      dc = v[0] * 8192 + 131072 + (128<<18);
+      ev = v[2] * stbi__f2f(1.847759065) - v[6] * stbi__f2f(0.765366865);
+      STBI__IDCT_4_ODD(v[7], v[5], v[3], v[1])
+      o[0] = stbi__clamp((dc + ev + t2) >> 18);
+      o[3] = stbi__clamp((dc + ev - t2) >> 18);
+      o[1] = stbi__clamp((dc - ev + t0) >> 18);
+      o[2] = stbi__clamp((dc - ev - t0) >> 18);
+   }
+}
+
+#define STBI__IDCT_2_ODD(z1,z2,z3,z4) \
+   t0 = (z1) * stbi__f2f(-0.720959822) + (z2) * stbi__f2f( 0.850430095) \
+      + (z3) * stbi__f2f(-1.272758580) + (z4) * stbi__f2f( 3.624509785);
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,val[16],*v=val;
+   short *d = data;
+
+   // columns; only the odd ones and the dc are needed by the rows
+   for (i=0; i < 8; ++i,++d, ++v) {
+      int t0,t10;
+      if (i == 2 || i == 4 || i == 6) continue;
+      if (d[8]==0 && d[24]==0 && d[40]==0 && d[56]==0) {
+         v[0] = v[8] = d[0]*4;
+         continue;
+      }
+      t10 = stbi__fsh(d[0]) * 4 + 2048;
+      STBI__IDCT_2_ODD(d[56], d[40], d[24], d[8])
+      v[0] = (t10 + t0) >> 12;
+      v[8] = (t10 - t0) >> 12;
+   }
+
+   for (i=0, v=val; i < 2; ++i,v+=8,out+=out_stride) {
+      int t0,t10;
+      t10 = v[0] * 16384 + 262144 + (128<<19);
+      STBI__IDCT_2_ODD(v[7], v[5], v[3], v[1])
+      out[0] = stbi__clamp((t10 + t0) >> 19);
+      out[1] = stbi__clamp((t10 - t0) >> 19);
+   }
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2507,6 +3096,188 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 
 #endif // STBI_SSE2
 
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two blocks at once: the sse2 version above with the low
+// 128-bit lane of every register holding the first block and the high lane the
+// second. every step stays within its lane, so each block comes out exactly as
+// from the generic C version.
+STBI__AVX2_TARGET
+static void stbi__idct_avx2(stbi_uc *out0, int out_stride0, short *data0, stbi_uc *out1, int out_stride1, short *data1)
+{
+   __m256i row0, row1, row2, row3, row4, row5, row6, row7;
+   __m256i tmp;
+   int k;
+
+   #define dct_const(x,y)  _mm256_setr_epi16((x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y),(x),(y))
+
+   #define dct_rot(out0,out1, x,y,c0,c1) \
+      __m256i c0##lo = _mm256_unpacklo_epi16((x),(y)); \
+      __m256i c0##hi = _mm256_unpackhi_epi16((x),(y)); \
+      __m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+      __m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+      __m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+      __m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+   #define dct_widen(out, in) \
+      __m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+      __m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+   #define dct_wadd(out, a, b) \
+      __m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+   #define dct_wsub(out, a, b) \
+      __m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+      __m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+   #define dct_bfly32o(out0, out1, a,b,bias,s) \
+      { \
+         __m256i abiased_l = _mm256_add_epi32(a##_l, bias); \
+         __m256i abiased_h = _mm256_add_epi32(a##_h, bias); \
+         dct_wadd(sum, abiased, b); \
+         dct_wsub(dif, abiased, b); \
+         out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+         out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+      }
+
+   #define dct_interleave8(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi8(a, b); \
+      b = _mm256_unpackhi_epi8(tmp, b)
+
+   #define dct_interleave16(a, b) \
+      tmp = a; \
+      a = _mm256_unpacklo_epi16(a, b); \
+      b = _mm256_unpackhi_epi16(tmp, b)
+
+   #define dct_pass(bias,shift) \
+      { \
+         /* even part */ \
+         dct_rot(t2e,t3e, row2,row6, rot0_0,rot0_1); \
+         __m256i sum04 = _mm256_add_epi16(row0, row4); \
+         __m256i dif04 = _mm256_sub_epi16(row0, row4); \
+         dct_widen(t0e, sum04); \
+         dct_widen(t1e, dif04); \
+         dct_wadd(x0, t0e, t3e); \
+         dct_wsub(x3, t0e, t3e); \
+         dct_wadd(x1, t1e, t2e); \
+         dct_wsub(x2, t1e, t2e); \
+         /* odd part */ \
+         dct_rot(y0o,y2o, row7,row3, rot2_0,rot2_1); \
+         dct_rot(y1o,y3o, row5,row1, rot3_0,rot3_1); \
+         __m256i sum17 = _mm256_add_epi16(row1, row7); \
+         __m256i sum35 = _mm256_add_epi16(row3, row5); \
+         dct_rot(y4o,y5o, sum17,sum35, rot1_0,rot1_1); \
+         dct_wadd(x4, y0o, y4o); \
+         dct_wadd(x5, y1o, y5o); \
+         dct_wadd(x6, y2o, y5o); \
+         dct_wadd(x7, y3o, y4o); \
+         dct_bfly32o(row0,row7, x0,x7,bias,shift); \
+         dct_bfly32o(row1,row6, x1,x6,bias,shift); \
+         dct_bfly32o(row2,row5, x2,x5,bias,shift); \
+         dct_bfly32o(row3,row4, x3,x4,bias,shift); \
+      }
+
+   // row k of both blocks; the pending block isn't necessarily aligned
+   #define dct_load(k) \
+      _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) (data0 + (k)*8))), \
+                              _mm_loadu_si128((const __m128i *) (data1 + (k)*8)), 1)
+
+   __m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+   __m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f( 0.765366865f), stbi__f2f(0.5411961f));
+   __m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+   __m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+   __m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f( 0.298631336f), stbi__f2f(-1.961570560f));
+   __m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f( 3.072711026f));
+   __m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f( 2.053119869f), stbi__f2f(-0.390180644f));
+   __m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f( 1.501321110f));
+
+   // rounding biases in column/row passes, see stbi__idct_block for explanation.
+   __m256i bias_0 = _mm256_set1_epi32(512);
+   __m256i bias_1 = _mm256_set1_epi32(65536 + (128<<17));
+
+   // load
+   row0 = dct_load(0);
+   row1 = dct_load(1);
+   row2 = dct_load(2);
+   row3 = dct_load(3);
+   row4 = dct_load(4);
+   row5 = dct_load(5);
+   row6 = dct_load(6);
+   row7 = dct_load(7);
+
+   // column pass
+   dct_pass(bias_0, 10);
+
+   {
+      // 16bit 8x8 transpose pass 1
+      dct_interleave16(row0, row4);
+      dct_interleave16(row1, row5);
+      dct_interleave16(row2, row6);
+      dct_interleave16(row3, row7);
+
+      // transpose pass 2
+      dct_interleave16(row0, row2);
+      dct_interleave16(row1, row3);
+      dct_interleave16(row4, row6);
+      dct_interleave16(row5, row7);
+
+      // transpose pass 3
+      dct_interleave16(row0, row1);
+      dct_interleave16(row2, row3);
+      dct_interleave16(row4, row5);
+      dct_interleave16(row6, row7);
+   }
+
+   // row pass
+   dct_pass(bias_1, 17);
+
+   {
+      // pack
+      __m256i p0 = _mm256_packus_epi16(row0, row1);
+      __m256i p1 = _mm256_packus_epi16(row2, row3);
+      __m256i p2 = _mm256_packus_epi16(row4, row5);
+      __m256i p3 = _mm256_packus_epi16(row6, row7);
+      __m128i rows[8];
+
+      // 8bit 8x8 transpose pass 1
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // transpose pass 2
+      dct_interleave8(p0, p1);
+      dct_interleave8(p2, p3);
+
+      // transpose pass 3
+      dct_interleave8(p0, p2);
+      dct_interleave8(p1, p3);
+
+      // store, low lanes to the first block and high lanes to the second
+      rows[0] = _mm256_castsi256_si128(p0); rows[1] = _mm256_extracti128_si256(p0, 1);
+      rows[2] = _mm256_castsi256_si128(p2); rows[3] = _mm256_extracti128_si256(p2, 1);
+      rows[4] = _mm256_castsi256_si128(p1); rows[5] = _mm256_extracti128_si256(p1, 1);
+      rows[6] = _mm256_castsi256_si128(p3); rows[7] = _mm256_extracti128_si256(p3, 1);
+      for (k=0; k < 8; k += 2) {
+         _mm_storel_epi64((__m128i *) out0, rows[k]); out0 += out_stride0;
+         _mm_storel_epi64((__m128i *) out0, _mm_shuffle_epi32(rows[k], 0x4e)); out0 += out_stride0;
+         _mm_storel_epi64((__m128i *) out1, rows[k+1]); out1 += out_stride1;
+         _mm_storel_epi64((__m128i *) out1, _mm_shuffle_epi32(rows[k+1], 0x4e)); out1 += out_stride1;
+      }
+   }
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_load
+}
+#endif // STBI_AVX2
+
 #ifdef STBI_NEON
 
 // NEON integer IDCT. should produce bit-identical
@@ -2749,8 +3520,177 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
    // since we don't even allow 1<<30 pixels
 }
 
+// row streaming for stbi_load_rows, with the color conversion below
+static int stbi__jpeg_rows_begin(stbi__jpeg *z);
+static int stbi__jpeg_rows_band(stbi__jpeg *z, int mcu_row);
+static int stbi__jpeg_emit_scan(stbi__jpeg *z);
+
+// parallel decoding of baseline scans with restart intervals. every interval starts
+// with a fresh entropy decoder and dc prediction, so once the RSTn markers are found,
+// intervals decode independently into disjoint blocks of the component planes.
+#define STBI__JPEG_MAX_TASKS 64
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **starts;  // first byte of each interval, starts[intervals] is the end of the scan
+   int intervals;
+   int mcus;          // in the scan
+   int per_task;      // intervals decoded by one task
+   stbi__task_flag failed;
+} stbi__jpeg_parallel;
+
+// inverse transform a dequantized block into block (bx,by) of component n; blocks
+// are 8>>scale_shift pixels a side. with a two-block kernel the block is held back
+// until the next one arrives, so stbi__jpeg_idct_flush must run before the
+// component planes are read.
+static void stbi__jpeg_idct(stbi__jpeg *z, int n, int bx, int by, short *data)
+{
+   int size = 8 >> z->scale_shift;
+   int out_stride = z->img_comp[n].w2;
+   stbi_uc *out;
+   if (z->idct_skip) return;
+   by -= z->band_mcu_y * z->img_comp[n].v;
+   out = z->img_comp[n].data + out_stride*by*size + bx*size;
+   if (!z->idct_block2_kernel) {
+      z->idct_block_kernel(out, out_stride, data);
+   } else if (z->idct_pending_out) {
+      z->idct_block2_kernel(z->idct_pending_out, z->idct_pending_stride, z->idct_pending, out, out_stride, data);
+      z->idct_pending_out = NULL;
+   } else {
+      memcpy(z->idct_pending, data, sizeof(z->idct_pending));
+      z->idct_pending_out = out;
+      z->idct_pending_stride = out_stride;
+   }
+}
+
+static void stbi__jpeg_idct_flush(stbi__jpeg *z)
+{
+   if (z->idct_pending_out) {
+      // the single-block kernels load aligned
+      STBI_SIMD_ALIGN(short, data[64]);
+      memcpy(data, z->idct_pending, sizeof(data));
+      z->idct_block_kernel(z->idct_pending_out, z->idct_pending_stride, data);
+      z->idct_pending_out = NULL;
+   }
+}
+
+// decode one MCU of a baseline scan, given its index in scan order
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, int mcu)
+{
+   int i,j,k,x,y;
+   STBI_SIMD_ALIGN(short, data[64]);
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int w = (z->img_comp[n].x+7) >> 3;
+      int ha = z->img_comp[n].ha;
+      i = mcu % w;
+      j = mcu / w;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      stbi__jpeg_idct(z, n, i, j, data);
+      return 1;
+   }
+   i = mcu % z->img_mcu_x;
+   j = mcu / z->img_mcu_x;
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            stbi__jpeg_idct(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
+         }
+      }
+   }
+   return 1;
+}
+
+static void stbi__jpeg_parallel_task(void *task_data, int index)
+{
+   stbi__jpeg_parallel *p = (stbi__jpeg_parallel *) task_data;
+   stbi__context s;
+   int first = index * p->per_task;
+   int last = first + p->per_task;
+   int k,m;
+   // private entropy decoder state; tables and component planes are shared
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) { p->failed = 1; return; }
+   memcpy(z, p->z, sizeof(stbi__jpeg));
+   z->s = &s;
+   if (last > p->intervals) last = p->intervals;
+   for (k=first; k < last; ++k) {
+      int begin = k * z->restart_interval;
+      int end = begin + z->restart_interval;
+      if (end > p->mcus) end = p->mcus;
+      // the RSTn marker ending the interval makes the decoder pad with zeros, as it does serially
+      stbi__start_mem(&s, p->starts[k], (int) (p->starts[k+1] - p->starts[k]));
+      stbi__jpeg_reset(z);
+      for (m=begin; m < end; ++m)
+         if (!stbi__jpeg_decode_mcu(z, m)) { p->failed = 1; break; }
+   }
+   stbi__jpeg_idct_flush(z);
+   STBI_FREE(z);
+}
+
+// returns -1 if the scan can't be split, otherwise the result of decoding it
+static int stbi__jpeg_parse_parallel(stbi__jpeg *z)
+{
+   stbi__jpeg_parallel p;
+   stbi__context *s = z->s;
+   stbi_uc *pos, *end = s->img_buffer_end;
+   int found = 0, tasks;
+
+   // intervals are located in memory, so callback sources stay serial
+   if (!stbi__parallel_for_func || z->progressive || !z->restart_interval || s->io.read != NULL) return -1;
+   // streamed rows are converted in order as each mcu row completes
+   if (z->band) return -1;
+
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      p.mcus = ((z->img_comp[n].x+7) >> 3) * ((z->img_comp[n].y+7) >> 3);
+   } else
+      p.mcus = z->img_mcu_x * z->img_mcu_y;
+   p.intervals = (p.mcus + z->restart_interval - 1) / z->restart_interval;
+   if (p.intervals < 2) return -1;
+
+   p.starts = (stbi_uc **) stbi__malloc_mad2(p.intervals + 1, sizeof(stbi_uc *), 0);
+   if (!p.starts) return -1;
+
+   // find the RSTn markers, skipping stuffed zero bytes and fill bytes
+   p.starts[0] = s->img_buffer;
+   for (pos = s->img_buffer; pos + 1 < end; ++pos) {
+      if (pos[0] != 0xff || pos[1] == 0x00 || pos[1] == 0xff) continue;
+      if (!STBI__RESTART(pos[1]) || found + 1 == p.intervals) break;
+      p.starts[++found] = pos + 2;
+      ++pos;
+   }
+   if (found + 1 != p.intervals) {
+      // corrupt or truncated; the serial decoder recovers what it can
+      STBI_FREE(p.starts);
+      return -1;
+   }
+   p.starts[p.intervals] = pos + 1 < end ? pos : end;
+
+   p.z = z;
+   p.failed = 0;
+   tasks = p.intervals < STBI__JPEG_MAX_TASKS ? p.intervals : STBI__JPEG_MAX_TASKS;
+   p.per_task = (p.intervals + tasks - 1) / tasks;
+   tasks = (p.intervals + p.per_task - 1) / p.per_task;
+   stbi__parallel(tasks, stbi__jpeg_parallel_task, &p);
+
+   // continue at the marker after the scan
+   s->img_buffer = p.starts[p.intervals];
+   STBI_FREE(p.starts);
+   stbi__jpeg_reset(z);
+   // the tasks set their failure reason on their own threads
+   if (p.failed) return stbi__err("bad restart interval", "Corrupt JPEG");
+   return 1;
+}
+
 static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
+   int parallel = stbi__jpeg_parse_parallel(z);
+   if (parallel >= 0) return parallel;
    stbi__jpeg_reset(z);
    if (!z->progressive) {
       if (z->scan_n == 1) {
@@ -2767,7 +3707,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               stbi__jpeg_idct(z, n, i, j, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2777,6 +3717,10 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->band && ((j+1) % z->img_comp[n].v == 0 || j+1 == h)) {
+               if (!stbi__jpeg_rows_band(z, j / z->img_comp[n].v)) return 0;
+               if (z->rows_done) return 1;
+            }
          }
          return 1;
       } else { // interleaved
@@ -2791,11 +3735,9 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-                        z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+                        stbi__jpeg_idct(z, n, i*z->img_comp[n].h + x, j*z->img_comp[n].v + y, data);
                      }
                   }
                }
@@ -2807,6 +3749,10 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   stbi__jpeg_reset(z);
                }
             }
+            if (z->band) {
+               if (!stbi__jpeg_rows_band(z, j)) return 0;
+               if (z->rows_done) return 1;
+            }
          }
          return 1;
       }
@@ -2873,30 +3819,74 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    }
 }
 
-static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
+// dequantize and idct block rows j0..j1-1 of component n of a progressive image.
+// the coefficients are left alone, so later scans can still refine them
+static void stbi__jpeg_finish_rows(stbi__jpeg *z, int n, int j0, int j1)
 {
-   int i;
-   for (i=0; i < 64; ++i)
-      data[i] *= dequant[i];
+   STBI_SIMD_ALIGN(short, data[64]);
+   int i,j,k;
+   int w = (z->img_comp[n].x+7) >> 3;
+   stbi__uint16 *dequant = z->dequant[z->img_comp[n].tq];
+   for (j=j0; j < j1; ++j) {
+      for (i=0; i < w; ++i) {
+         short *coeff = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+         for (k=0; k < 64; ++k)
+            data[k] = coeff[k] * dequant[k];
+         stbi__jpeg_idct(z, n, i, j, data);
+      }
+   }
 }
 
-static void stbi__jpeg_finish(stbi__jpeg *z)
+typedef struct
 {
-   if (z->progressive) {
-      // dequantize and idct the data
-      int i,j,n;
+   stbi__jpeg *z;
+   int first[5];      // first task of each component, first[img_n] is the task count
+   int rows[4];       // block rows per task of each component
+   stbi__task_flag failed;
+} stbi__jpeg_finish_work;
+
+static void stbi__jpeg_finish_task(void *task_data, int index)
+{
+   stbi__jpeg_finish_work *f = (stbi__jpeg_finish_work *) task_data;
+   int n = 0, j0, j1, h;
+   // private idct state; the planes are shared, and tasks write disjoint blocks
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) { f->failed = 1; return; }
+   memcpy(z, f->z, sizeof(stbi__jpeg));
+   while (index >= f->first[n+1]) ++n;
+   h = (z->img_comp[n].y+7) >> 3;
+   j0 = (index - f->first[n]) * f->rows[n];
+   j1 = j0 + f->rows[n] < h ? j0 + f->rows[n] : h;
+   stbi__jpeg_finish_rows(z, n, j0, j1);
+   stbi__jpeg_idct_flush(z);
+   STBI_FREE(z);
+}
+
+// turn the coefficients of a progressive image into the component planes. with the
+// parallel hook, each component is split into bands of block rows
+static int stbi__jpeg_finish(stbi__jpeg *z)
+{
+   int n;
+   if (!z->progressive) return 1;
+   if (stbi__parallel_for_func) {
+      stbi__jpeg_finish_work f;
+      int per = STBI__JPEG_MAX_TASKS / z->s->img_n;
+      f.z = z;
+      f.first[0] = 0;
+      f.failed = 0;
       for (n=0; n < z->s->img_n; ++n) {
-         int w = (z->img_comp[n].x+7) >> 3;
          int h = (z->img_comp[n].y+7) >> 3;
-         for (j=0; j < h; ++j) {
-            for (i=0; i < w; ++i) {
-               short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-               stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
-            }
-         }
+         f.rows[n] = (h + per - 1) / per;
+         f.first[n+1] = f.first[n] + (h + f.rows[n] - 1) / f.rows[n];
       }
+      stbi__parallel(f.first[z->s->img_n], stbi__jpeg_finish_task, &f);
+      if (f.failed) return stbi__err("outofmem", "Out of memory");
+   } else {
+      for (n=0; n < z->s->img_n; ++n)
+         stbi__jpeg_finish_rows(z, n, 0, (z->img_comp[n].y+7) >> 3);
+      stbi__jpeg_idct_flush(z);
    }
+   return 1;
 }
 
 static int stbi__process_marker(stbi__jpeg *z, int m)
@@ -3063,6 +4053,41 @@ static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
    return why;
 }
 
+static int stbi__jpeg_alloc_components(stbi__jpeg *z)
+{
+   int i;
+   for (i=0; i < z->s->img_n; ++i) {
+      // to simplify generation, we'll allocate enough memory to decode
+      // the bogus oversized data from using interleaved MCUs and their
+      // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
+      // discard the extra data until colorspace conversion
+      //
+      // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
+      // so these muls can't overflow with 32-bit ints (which we require).
+      // when decoding scaled the blocks shrink to 8>>scale_shift pixels a side,
+      // and when streaming rows the planes only hold two rows of MCUs
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * (8 >> z->scale_shift);
+      z->img_comp[i].h2 = (z->band ? 2 : z->img_mcu_y) * z->img_comp[i].v * (8 >> z->scale_shift);
+      z->img_comp[i].coeff = 0;
+      z->img_comp[i].raw_coeff = 0;
+      z->img_comp[i].linebuf = NULL;
+      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
+      if (z->img_comp[i].raw_data == NULL)
+         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+      // align blocks for idct using mmx/sse
+      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
+      if (z->progressive) {
+         z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+         z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 64, z->img_comp[i].coeff_h, sizeof(short), 15);
+         if (z->img_comp[i].raw_coeff == NULL)
+            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
+         z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
+      }
+   }
+   return 1;
+}
+
 static int stbi__process_frame_header(stbi__jpeg *z, int scan)
 {
    stbi__context *s = z->s;
@@ -3115,35 +4140,12 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // number of effective pixels (e.g. for non-interleaved MCU)
       z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max-1) / h_max;
       z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max-1) / v_max;
-      // to simplify generation, we'll allocate enough memory to decode
-      // the bogus oversized data from using interleaved MCUs and their
-      // big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-      // discard the extra data until colorspace conversion
-      //
-      // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-      // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-      z->img_comp[i].coeff = 0;
-      z->img_comp[i].raw_coeff = 0;
-      z->img_comp[i].linebuf = NULL;
-      z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-      if (z->img_comp[i].raw_data == NULL)
-         return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-      // align blocks for idct using mmx/sse
-      z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
-      if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
-         if (z->img_comp[i].raw_coeff == NULL)
-            return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
-         z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
-      }
    }
 
-   return 1;
+   // progressive scans revisit every block, so the whole image stays in memory
+   if (z->progressive) z->band = 0;
+   z->band_mcu_y = z->band ? -1 : 0;
+   return stbi__jpeg_alloc_components(z);
 }
 
 // use comparisons since in some cases we handle more than one case (e.g. SOF)
@@ -3180,6 +4182,21 @@ static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
 }
 
 // decode image to YCbCr format
+// move past a scan without decoding it, stopping at the marker that ends it
+static void stbi__jpeg_skip_entropy_coded_data(stbi__jpeg *j)
+{
+   while (!stbi__at_eof(j->s)) {
+      int x = stbi__get8(j->s);
+      if (x != 255) continue;
+      do x = stbi__get8(j->s); while (x == 255 && !stbi__at_eof(j->s));
+      // skip stuffed zero bytes and restart markers
+      if (x != 0 && !STBI__RESTART(x)) {
+         j->marker = (unsigned char) x;
+         return;
+      }
+   }
+}
+
 static int stbi__decode_jpeg_image(stbi__jpeg *j)
 {
    int m;
@@ -3192,8 +4209,20 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    m = stbi__get_marker(j);
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
+         // another scan follows, so the ones so far make a preview
+         if (j->scan_callback && j->progressive && j->scans && !stbi__jpeg_emit_scan(j)) return 0;
+         ++j->scans;
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+         if (j->rows && !stbi__jpeg_rows_begin(j)) return 0;
+         if (j->progressive && j->spec_start != 0 && j->scale_shift == 3) {
+            // a 1/8 decode only needs the dc coefficients
+            stbi__jpeg_skip_entropy_coded_data(j);
+         } else {
+            if (!stbi__parse_entropy_coded_data(j)) return 0;
+            stbi__jpeg_idct_flush(j);
+            // the rows of the region have been delivered; the rest of the file can go unread
+            if (j->rows_done) return 1;
+         }
          if (j->marker == STBI__MARKER_none ) {
             // handle 0s at the end of image data from IP Kamera 9060
             while (!stbi__at_eof(j->s)) {
@@ -3215,9 +4244,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
       }
       m = stbi__get_marker(j);
    }
-   if (j->progressive)
-      stbi__jpeg_finish(j);
-   return 1;
+   return stbi__jpeg_finish(j);
 }
 
 // static jfif-centered resampling (across block boundaries)
@@ -3396,7 +4423,76 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 #endif
 
       // "previous" value for next iter
-      t1 = 3*in_near[i+7] + in_far[i+7];
+      t1 = 3*in_near[i+7] + in_far[i+7];
+   }
+
+   t0 = t1;
+   t1 = 3*in_near[i] + in_far[i];
+   out[i*2] = stbi__div16(3*t1 + t0 + 8);
+
+   for (++i; i < w; ++i) {
+      t0 = t1;
+      t1 = 3*in_near[i]+in_far[i];
+      out[i*2-1] = stbi__div16(3*t0 + t1 + 8);
+      out[i*2  ] = stbi__div16(3*t1 + t0 + 8);
+   }
+   out[w*2-1] = stbi__div4(t1+2);
+
+   STBI_NOTUSED(hs);
+
+   return out;
+}
+#endif
+
+#ifdef STBI_AVX2
+// the sse2 version above, 16 pixels at a time
+STBI__AVX2_TARGET
+static stbi_uc *stbi__resample_row_hv_2_avx2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+   int i=0,t0,t1;
+
+   if (w == 1) {
+      out[0] = out[1] = stbi__div4(3*in_near[0] + in_far[0] + 2);
+      return out;
+   }
+
+   t1 = 3*in_near[0] + in_far[0];
+   for (; i < ((w-1) & ~15); i += 16) {
+      // vertical pass, 3*x + y = 4*x + (y - x)
+      __m256i farw  = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_far + i)));
+      __m256i nearw = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i *) (in_near + i)));
+      __m256i diff  = _mm256_sub_epi16(farw, nearw);
+      __m256i nears = _mm256_slli_epi16(nearw, 2);
+      __m256i curr  = _mm256_add_epi16(nears, diff); // current row
+
+      // shift by one pixel across the lane boundary: alignr only shifts within
+      // lanes, so pair each lane with its neighbour first.
+      __m256i lo   = _mm256_permute2x128_si256(curr, curr, 0x08); // 0, low lane
+      __m256i hi   = _mm256_permute2x128_si256(curr, curr, 0x81); // high lane, 0
+      __m256i prv0 = _mm256_alignr_epi8(curr, lo, 14);
+      __m256i nxt0 = _mm256_alignr_epi8(hi, curr, 2);
+      __m256i prev = _mm256_insert_epi16(prv0, t1, 0);
+      __m256i next = _mm256_insert_epi16(nxt0, 3*in_near[i+16] + in_far[i+16], 15);
+
+      // horizontal pass, polyphase as in the sse2 version
+      __m256i bias = _mm256_set1_epi16(8);
+      __m256i curs = _mm256_slli_epi16(curr, 2);
+      __m256i prvd = _mm256_sub_epi16(prev, curr);
+      __m256i nxtd = _mm256_sub_epi16(next, curr);
+      __m256i curb = _mm256_add_epi16(curs, bias);
+      __m256i even = _mm256_add_epi16(prvd, curb);
+      __m256i odd  = _mm256_add_epi16(nxtd, curb);
+
+      // interleave even and odd pixels, then undo scaling. the unpacks and the
+      // pack work per lane, which leaves the 32 outputs in order.
+      __m256i int0 = _mm256_unpacklo_epi16(even, odd);
+      __m256i int1 = _mm256_unpackhi_epi16(even, odd);
+      __m256i de0  = _mm256_srli_epi16(int0, 4);
+      __m256i de1  = _mm256_srli_epi16(int1, 4);
+      _mm256_storeu_si256((__m256i *) (out + i*2), _mm256_packus_epi16(de0, de1));
+
+      // "previous" value for next iter
+      t1 = 3*in_near[i+15] + in_far[i+15];
    }
 
    t0 = t1;
@@ -3591,26 +4687,119 @@ static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc cons
 }
 #endif
 
+#ifdef STBI_AVX2
+// the sse2 version, 16 pixels at a time; it finishes off the row
+STBI__AVX2_TARGET
+static void stbi__YCbCr_to_RGB_avx2(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+   int i = 0;
+
+   if (step == 4) {
+      __m256i signflip  = _mm256_set1_epi8(-0x80);
+      __m256i cr_const0 = _mm256_set1_epi16(   (short) ( 1.40200f*4096.0f+0.5f));
+      __m256i cr_const1 = _mm256_set1_epi16( - (short) ( 0.71414f*4096.0f+0.5f));
+      __m256i cb_const0 = _mm256_set1_epi16( - (short) ( 0.34414f*4096.0f+0.5f));
+      __m256i cb_const1 = _mm256_set1_epi16(   (short) ( 1.77200f*4096.0f+0.5f));
+      __m256i y_bias = _mm256_set1_epi8((char) (unsigned char) 128);
+      __m256i xw = _mm256_set1_epi16(255); // alpha channel
+
+      for (; i+15 < count; i += 16) {
+         // load, with pixels 0-7 in the low half of the low lane and 8-15 in
+         // the low half of the high lane, where the per-lane unpacks take them
+         __m256i y_bytes  = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (y+i))), 0x50);
+         __m256i cr_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (pcr+i))), 0x50);
+         __m256i cb_bytes = _mm256_permute4x64_epi64(_mm256_castsi128_si256(_mm_loadu_si128((__m128i *) (pcb+i))), 0x50);
+         __m256i cr_biased = _mm256_xor_si256(cr_bytes, signflip); // -128
+         __m256i cb_biased = _mm256_xor_si256(cb_bytes, signflip); // -128
+
+         // unpack to short (and left-shift cr, cb by 8)
+         __m256i yw  = _mm256_unpacklo_epi8(y_bias, y_bytes);
+         __m256i crw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cr_biased);
+         __m256i cbw = _mm256_unpacklo_epi8(_mm256_setzero_si256(), cb_biased);
+
+         // color transform
+         __m256i yws = _mm256_srli_epi16(yw, 4);
+         __m256i cr0 = _mm256_mulhi_epi16(cr_const0, crw);
+         __m256i cb0 = _mm256_mulhi_epi16(cb_const0, cbw);
+         __m256i cb1 = _mm256_mulhi_epi16(cbw, cb_const1);
+         __m256i cr1 = _mm256_mulhi_epi16(crw, cr_const1);
+         __m256i rws = _mm256_add_epi16(cr0, yws);
+         __m256i gwt = _mm256_add_epi16(cb0, yws);
+         __m256i bws = _mm256_add_epi16(yws, cb1);
+         __m256i gws = _mm256_add_epi16(gwt, cr1);
+
+         // descale
+         __m256i rw = _mm256_srai_epi16(rws, 4);
+         __m256i bw = _mm256_srai_epi16(bws, 4);
+         __m256i gw = _mm256_srai_epi16(gws, 4);
+
+         // back to byte, set up for transpose
+         __m256i brb = _mm256_packus_epi16(rw, bw);
+         __m256i gxb = _mm256_packus_epi16(gw, xw);
+
+         // transpose to interleave channels; each lane now holds pixels 0-3 and
+         // 4-7 of its half in o0 and o1
+         __m256i t0 = _mm256_unpacklo_epi8(brb, gxb);
+         __m256i t1 = _mm256_unpackhi_epi8(brb, gxb);
+         __m256i o0 = _mm256_unpacklo_epi16(t0, t1);
+         __m256i o1 = _mm256_unpackhi_epi16(t0, t1);
+
+         // store
+         _mm256_storeu_si256((__m256i *) (out + 0), _mm256_permute2x128_si256(o0, o1, 0x20));
+         _mm256_storeu_si256((__m256i *) (out + 32), _mm256_permute2x128_si256(o0, o1, 0x31));
+         out += 64;
+      }
+   }
+
+   stbi__YCbCr_to_RGB_simd(out, y+i, pcb+i, pcr+i, count-i, step);
+}
+#endif
+
 // set up the kernels
 static void stbi__setup_jpeg(stbi__jpeg *j)
 {
+   int level = stbi_get_simd_level();
+   STBI_NOTUSED(level);
+
    j->idct_block_kernel = stbi__idct_block;
+   j->idct_block2_kernel = NULL;
+   j->idct_pending_out = NULL;
+   j->rows = NULL;
+   j->band = 0;
+   j->band_mcu_y = 0;
+   j->idct_skip = 0;
+   j->rows_done = 0;
+   j->scan_callback = j->s->scan_callback;
+   j->scan_user = j->s->scan_user;
+   j->scans = 0;
+   j->req_comp = 0;
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
 
-#ifdef STBI_SSE2
-   if (stbi__sse2_available()) {
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+   if (level >= STBI_simd_sse2) {
       j->idct_block_kernel = stbi__idct_simd;
       j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
       j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
    }
 #endif
 
-#ifdef STBI_NEON
-   j->idct_block_kernel = stbi__idct_simd;
-   j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-   j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+#ifdef STBI_AVX2
+   if (level >= STBI_simd_avx2) {
+      // single blocks, e.g. the last one of a scan, still go through sse2
+      j->idct_block2_kernel = stbi__idct_avx2;
+      j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_avx2;
+      j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_avx2;
+   }
 #endif
+
+   // scaled decoding, see stbi_load_scaled. the reduced transforms are cheap
+   // enough that the entropy decoder dominates, so they have no simd versions
+   j->scale_shift = j->s->scale_shift;
+   if (j->scale_shift) {
+      j->idct_block_kernel = j->scale_shift == 1 ? stbi__idct_block_4x4 : j->scale_shift == 2 ? stbi__idct_block_2x2 : stbi__idct_block_1x1;
+      j->idct_block2_kernel = NULL;
+   }
 }
 
 // clean up the temporary component buffers
@@ -3636,173 +4825,486 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
-{
-   int n, decode_n, is_rgb;
-   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-   // validate req_comp
-   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
-
-   // load a jpeg image from whichever source, but leave in YCbCr format
-   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
-
-   // determine actual number of components to generate
-   n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
-
-   is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-   if (z->s->img_n == 3 && n < 3 && !is_rgb)
-      decode_n = 1;
-   else
-      decode_n = z->s->img_n;
-
-   // resample and color-convert
-   {
-      int k;
-      unsigned int i,j;
-      stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
-
-      stbi__resample res_comp[4];
-
+// resample and color-convert output rows [j0,j1) into output, which starts at row j0.
+// the resamplers must be positioned at row j0. like the serial loop, this may write one
+// byte past the last pixel.
+// rows j0..j1-1 go stride bytes apart from output on; a negative stride writes
+// them bottom-up. 3 channel rows get a byte written past their end, so bottom-up
+// that byte of the row written before is put back.
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__resample *res_comp, stbi_uc **linebuf, stbi_uc *output, int stride, int n, int decode_n, int is_rgb, int j0, int j1)
+{
+   int k,j;
+   unsigned int i;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   for (j=j0; j < j1; ++j) {
+      stbi_uc *out = output + (ptrdiff_t) stride * (j - j0);
+      stbi_uc *past = out + n * z->s->img_x, keep = stride < 0 ? *past : 0;
       for (k=0; k < decode_n; ++k) {
          stbi__resample *r = &res_comp[k];
-
-         // allocate line buffer big enough for upsampling off the edges
-         // with upsample factor of 4
-         z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
-         if (!z->img_comp[k].linebuf) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-         r->hs      = z->img_h_max / z->img_comp[k].h;
-         r->vs      = z->img_v_max / z->img_comp[k].v;
-         r->ystep   = r->vs >> 1;
-         r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
-         r->ypos    = 0;
-         r->line0   = r->line1 = z->img_comp[k].data;
-
-         if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
-         else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
-         else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
-         else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
-         else                               r->resample = stbi__resample_row_generic;
-      }
-
-      // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-      if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
-
-      // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
                   out += n;
                }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
                for (i=0; i < z->s->img_x; ++i) {
                   stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
                   out += n;
                }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
                for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
                   out += n;
                }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
             }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
          }
       }
-      stbi__cleanup_jpeg(z);
-      *out_x = z->s->img_x;
-      *out_y = z->s->img_y;
-      if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-      return output;
+      if (stride < 0) *past = keep;
+   }
+}
+
+// position a resampler at output row j, as if rows 0..j-1 had been produced
+static void stbi__resample_seek(stbi__resample *r, int comp_y, int w2, int j)
+{
+   for (; j > 0; --j) {
+      if (++r->ystep >= r->vs) {
+         r->ystep = 0;
+         r->line0 = r->line1;
+         if (++r->ypos < comp_y)
+            r->line1 += w2;
+      }
+   }
+}
+
+// color conversion split into bands of rows, each with its own line buffers
+#define STBI__JPEG_CONVERT_ROWS 32
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample *res_comp;
+   stbi_uc *output;   // row 0
+   int stride;        // negative to write bottom-up
+   int n, decode_n, is_rgb;
+   int rows;          // per task
+   stbi__task_flag failed;
+} stbi__jpeg_convert;
+
+static void stbi__jpeg_convert_task(void *task_data, int index)
+{
+   stbi__jpeg_convert *c = (stbi__jpeg_convert *) task_data;
+   stbi__jpeg *z = c->z;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4];
+   int j0 = index * c->rows;
+   int j1 = j0 + c->rows < (int) z->s->img_y ? j0 + c->rows : (int) z->s->img_y;
+   int k, stride = z->s->img_x + 3;
+   int row = c->n * z->s->img_x;
+   // line buffers, then a scratch row: the row of a band that sits before the next
+   // band in memory goes through it so the byte written past its end can't clobber
+   // that band. bottom-up, that is the first row and it needs the one before too.
+   stbi_uc *lines = (stbi_uc *) stbi__malloc_mad2(c->decode_n, stride, row + 1);
+   stbi_uc *scratch;
+   if (!lines) { c->failed = 1; return; }
+   scratch = lines + c->decode_n * stride;
+   for (k=0; k < c->decode_n; ++k) {
+      res_comp[k] = c->res_comp[k];
+      stbi__resample_seek(&res_comp[k], z->img_comp[k].y, z->img_comp[k].w2, j0);
+      linebuf[k] = lines + k * stride;
+   }
+   if (c->stride < 0 ? j0 == 0 : j1 == (int) z->s->img_y) {
+      stbi__jpeg_convert_rows(z, res_comp, linebuf, c->output + (ptrdiff_t) c->stride * j0, c->stride, c->n, c->decode_n, c->is_rgb, j0, j1);
+   } else if (c->stride > 0) {
+      stbi__jpeg_convert_rows(z, res_comp, linebuf, c->output + (ptrdiff_t) c->stride * j0, c->stride, c->n, c->decode_n, c->is_rgb, j0, j1 - 1);
+      stbi__jpeg_convert_rows(z, res_comp, linebuf, scratch, row, c->n, c->decode_n, c->is_rgb, j1 - 1, j1);
+      memcpy(c->output + (ptrdiff_t) c->stride * (j1 - 1), scratch, row);
+   } else {
+      stbi__jpeg_convert_rows(z, res_comp, linebuf, scratch, row, c->n, c->decode_n, c->is_rgb, j0, j0 + 1);
+      memcpy(c->output + (ptrdiff_t) c->stride * j0, scratch, row);
+      stbi__jpeg_convert_rows(z, res_comp, linebuf, c->output + (ptrdiff_t) c->stride * (j0 + 1), c->stride, c->n, c->decode_n, c->is_rgb, j0 + 1, j1);
+   }
+   STBI_FREE(lines);
+}
+
+// set up the resamplers of the first decode_n components, starting at the top
+// of their planes
+static int stbi__jpeg_setup_resample(stbi__jpeg *z, stbi__resample *res_comp, int decode_n)
+{
+   int k;
+   for (k=0; k < decode_n; ++k) {
+      stbi__resample *r = &res_comp[k];
+
+      // allocate line buffer big enough for upsampling off the edges
+      // with upsample factor of 4
+      z->img_comp[k].linebuf = (stbi_uc *) stbi__malloc(z->s->img_x + 3);
+      if (!z->img_comp[k].linebuf) return stbi__err("outofmem", "Out of memory");
+
+      r->hs      = z->img_h_max / z->img_comp[k].h;
+      r->vs      = z->img_v_max / z->img_comp[k].v;
+      r->ystep   = r->vs >> 1;
+      r->w_lores = (z->s->img_x + r->hs-1) / r->hs;
+      r->ypos    = 0;
+      r->line0   = r->line1 = z->img_comp[k].data;
+
+      if      (r->hs == 1 && r->vs == 1) r->resample = resample_row_1;
+      else if (r->hs == 1 && r->vs == 2) r->resample = stbi__resample_row_v_2;
+      else if (r->hs == 2 && r->vs == 1) r->resample = stbi__resample_row_h_2;
+      else if (r->hs == 2 && r->vs == 2) r->resample = z->resample_row_hv_2_kernel;
+      else                               r->resample = stbi__resample_row_generic;
+   }
+   return 1;
+}
+
+// components decoded to produce n output channels
+static int stbi__jpeg_decode_n(stbi__jpeg *z, int n, int *is_rgb)
+{
+   *is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+   return z->s->img_n == 3 && n < 3 && !*is_rgb ? 1 : z->s->img_n;
+}
+
+// state of stbi_load_rows while decoding a jpeg
+typedef struct stbi__jpeg_rows
+{
+   stbi__rows *rows;
+   stbi__resample res_comp[4];
+   stbi_uc *buffer;   // converted rows on their way to the callback
+   int n, decode_n, is_rgb;
+   int flip;
+   int started;
+   int next;          // first row not converted yet
+   int y0, y1;        // rows of the region, counted from the top of the file
+} stbi__jpeg_rows;
+
+// called at every scan; the first one has all the headers in
+static int stbi__jpeg_rows_begin(stbi__jpeg *z)
+{
+   stbi__jpeg_rows *r = z->rows;
+   stbi__rows *rows = r->rows;
+   int k;
+   if (r->started) return 1;
+   r->started = 1;
+
+   r->n = rows->req_comp ? rows->req_comp : z->s->img_n >= 3 ? 3 : 1;
+   if (!stbi__rows_region(rows, z->s->img_x, z->s->img_y, r->n)) return 0;
+   r->y0 = r->flip ? (int) z->s->img_y - rows->y1 : rows->y0;
+   r->y1 = r->flip ? (int) z->s->img_y - rows->y0 : rows->y1;
+
+   // mcu rows only complete together when the scan interleaves every component;
+   // otherwise fall back to decoding the whole image before converting it
+   if (z->band && z->scan_n != z->s->img_n) {
+      stbi__free_jpeg_components(z, z->s->img_n, 0);
+      z->band = 0;
+      z->band_mcu_y = 0;
+      if (!stbi__jpeg_alloc_components(z)) return 0;
+   }
+
+   r->decode_n = stbi__jpeg_decode_n(z, r->n, &r->is_rgb);
+   if (!stbi__jpeg_setup_resample(z, r->res_comp, r->decode_n)) return 0;
+   r->buffer = (stbi_uc *) stbi__malloc_mad3(r->n, z->s->img_x, STBI__JPEG_CONVERT_ROWS, 1);
+   if (!r->buffer) return stbi__err("outofmem", "Out of memory");
+
+   if (z->band) {
+      // the first mcu row is decoded into the bottom half
+      for (k=0; k < r->decode_n; ++k)
+         r->res_comp[k].line0 = r->res_comp[k].line1 = z->img_comp[k].data + z->img_comp[k].v * 8 * z->img_comp[k].w2;
+      z->idct_skip = 2 * z->img_mcu_h <= r->y0;
+   }
+   return 1;
+}
+
+// convert rows up to end, handing the region's ones to the callback
+static int stbi__jpeg_rows_emit(stbi__jpeg *z, int end)
+{
+   stbi__jpeg_rows *r = z->rows;
+   stbi__rows *rows = r->rows;
+   stbi_uc *linebuf[4];
+   int k, row = r->n * z->s->img_x;
+   // stbi_load_into with packed rows: convert straight into the destination
+   int direct = rows->dest && rows->x0 == 0 && rows->dest_stride == row;
+   for (k=0; k < r->decode_n; ++k)
+      linebuf[k] = z->img_comp[k].linebuf;
+   if (end > r->y1) end = r->y1;
+
+   // rows above the region only move the resamplers along
+   if (r->next < r->y0) {
+      int skip = (end < r->y0 ? end : r->y0) - r->next;
+      for (k=0; k < r->decode_n; ++k)
+         stbi__resample_seek(&r->res_comp[k], z->img_comp[k].y, z->img_comp[k].w2, skip);
+      r->next += skip;
+   }
+   while (r->next < end) {
+      int j0 = r->next;
+      int j1 = j0 + STBI__JPEG_CONVERT_ROWS < end ? j0 + STBI__JPEG_CONVERT_ROWS : end;
+      stbi_uc *pixels = r->buffer + rows->x0 * r->n;
+      int y = j0 - r->y0, stride = row;
+      // 3 channel conversion writes a byte past each row, so the rows that would
+      // run past the destination go through the buffer
+      if (direct && (r->n != 3 || (r->flip ? j0 > r->y0 : j1 < r->y1))) {
+         if (r->flip)
+            stbi__jpeg_convert_rows(z, r->res_comp, linebuf, rows->dest + (size_t) (r->y1 - 1 - j0) * row, -row, r->n, r->decode_n, r->is_rgb, j0, j1);
+         else
+            stbi__jpeg_convert_rows(z, r->res_comp, linebuf, rows->dest + (size_t) y * row, row, r->n, r->decode_n, r->is_rgb, j0, j1);
+         r->next = j1;
+         continue;
+      }
+      stbi__jpeg_convert_rows(z, r->res_comp, linebuf, r->buffer, row, r->n, r->decode_n, r->is_rgb, j0, j1);
+      if (r->flip) {
+         y = r->y1 - j1;
+         pixels += (j1 - j0 - 1) * row;
+         stride = -row;
+      }
+      if (!stbi__rows_deliver(rows, y, j1 - j0, pixels, stride)) return 0;
+      r->next = j1;
+   }
+   if (r->next >= r->y1) z->rows_done = 1;
+   return 1;
+}
+
+// an mcu row has been decoded into the bottom half of the planes: convert the
+// rows that don't need the next one, then move it to the top half
+static int stbi__jpeg_rows_band(stbi__jpeg *z, int mcu_row)
+{
+   stbi__jpeg_rows *r = z->rows;
+   int k, end, max_vs = 1;
+   stbi__jpeg_idct_flush(z);
+   // upsampling reads up to a row of the component past the one an output row is in
+   for (k=0; k < r->decode_n; ++k)
+      if (r->res_comp[k].vs > max_vs) max_vs = r->res_comp[k].vs;
+   end = mcu_row + 1 == z->img_mcu_y ? (int) z->s->img_y : (mcu_row + 1) * z->img_mcu_h - max_vs;
+   if (!stbi__jpeg_rows_emit(z, end)) return 0;
+   if (z->rows_done) return 1;
+
+   for (k=0; k < z->s->img_n; ++k) {
+      int half = z->img_comp[k].v * 8 * z->img_comp[k].w2;
+      memcpy(z->img_comp[k].data, z->img_comp[k].data + half, half);
+      if (k < r->decode_n) {
+         r->res_comp[k].line0 -= half;
+         r->res_comp[k].line1 -= half;
+      }
+   }
+   z->band_mcu_y = mcu_row;
+   // nothing reads an mcu row that ends a whole mcu row above the region
+   z->idct_skip = (mcu_row + 3) * z->img_mcu_h <= r->y0;
+   return 1;
+}
+
+static int stbi__jpeg_load_rows(stbi__context *s, int *x, int *y, int *comp, stbi__rows *rows)
+{
+   stbi__jpeg_rows r;
+   stbi__jpeg *z;
+   int result;
+   if (rows->req_comp < 0 || rows->req_comp > 4) return stbi__err("bad req_comp", "Internal error");
+   z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) return stbi__err("outofmem", "Out of memory");
+   memset(&r, 0, sizeof(r));
+   r.rows = rows;
+   r.flip = stbi__vertically_flip_on_load;
+   z->s = s;
+   stbi__setup_jpeg(z);
+   z->rows = &r;
+   z->band = 1;
+   s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   result = stbi__decode_jpeg_image(z);
+   if (result && !r.started) result = stbi__err("no SOS", "Corrupt JPEG");
+   // progressive images are converted once their last scan is in
+   if (result && !z->band) result = stbi__jpeg_rows_emit(z, s->img_y);
+   // a missing restart marker ends the scan early, even after the last mcu.
+   // like stbi_load, deliver whatever the remaining rows hold
+   while (result && !z->rows_done)
+      result = stbi__jpeg_rows_band(z, z->band_mcu_y + 1);
+   if (result) {
+      *x = s->img_x;
+      *y = s->img_y;
+      if (comp) *comp = s->img_n >= 3 ? 3 : 1;
+   }
+   STBI_FREE(r.buffer);
+   stbi__cleanup_jpeg(z);
+   STBI_FREE(z);
+   return result;
+}
+
+// resample and color convert the planes into a new n channel image, bottom-up
+// with flip. the line buffers are freed again, so this can run after every scan.
+static stbi_uc *stbi__jpeg_output(stbi__jpeg *z, int n, int flip)
+{
+   int k, stride, decode_n, is_rgb;
+   stbi_uc *output, *first;
+   stbi__resample res_comp[4];
+
+   decode_n = stbi__jpeg_decode_n(z, n, &is_rgb);
+   if (!stbi__jpeg_setup_resample(z, res_comp, decode_n)) return NULL;
+
+   output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+   if (!output) {
+      stbi__err("outofmem", "Out of memory");
+   } else {
+      stride = n * z->s->img_x;
+      first = output;
+      if (flip) {
+         first += (size_t) stride * (z->s->img_y - 1);
+         stride = -stride;
+      }
+
+      // now go ahead and resample
+      if (stbi__parallel_for_func && z->s->img_y >= 2 * STBI__JPEG_CONVERT_ROWS) {
+         stbi__jpeg_convert c;
+         int tasks;
+         c.z = z;
+         c.res_comp = res_comp;
+         c.output = first;
+         c.stride = stride;
+         c.n = n;
+         c.decode_n = decode_n;
+         c.is_rgb = is_rgb;
+         c.rows = (z->s->img_y + STBI__JPEG_MAX_TASKS - 1) / STBI__JPEG_MAX_TASKS;
+         if (c.rows < STBI__JPEG_CONVERT_ROWS) c.rows = STBI__JPEG_CONVERT_ROWS;
+         c.failed = 0;
+         tasks = (z->s->img_y + c.rows - 1) / c.rows;
+         stbi__parallel(tasks, stbi__jpeg_convert_task, &c);
+         if (c.failed) { STBI_FREE(output); output = stbi__errpuc("outofmem", "Out of memory"); }
+      } else {
+         stbi_uc *linebuf[4];
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         stbi__jpeg_convert_rows(z, res_comp, linebuf, first, stride, n, decode_n, is_rgb, 0, z->s->img_y);
+      }
+   }
+   for (k=0; k < decode_n; ++k) {
+      STBI_FREE(z->img_comp[k].linebuf);
+      z->img_comp[k].linebuf = NULL;
+   }
+   return output;
+}
+
+// hand the image as the scans so far have it to the stbi_load_progressive callback
+static int stbi__jpeg_emit_scan(stbi__jpeg *z)
+{
+   int n = z->req_comp ? z->req_comp : z->s->img_n >= 3 ? 3 : 1;
+   int ok;
+   stbi_uc *image;
+   if (!stbi__jpeg_finish(z)) return 0;
+   image = stbi__jpeg_output(z, n, stbi__vertically_flip_on_load);
+   if (!image) return 0;
+   ok = z->scan_callback(z->scan_user, z->scans, image, z->s->img_x, z->s->img_y, n);
+   STBI_FREE(image);
+   return ok ? 1 : stbi__err("stopped", "Stopped by the callback");
+}
+
+// with flip the image is written bottom-up
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp, int flip)
+{
+   stbi_uc *output;
+   z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+
+   // validate req_comp
+   if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   z->req_comp = req_comp;
+
+   // load a jpeg image from whichever source, but leave in YCbCr format
+   if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
+
+   // the planes hold the scaled image; resample and convert that
+   if (z->scale_shift) {
+      int k, round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (k=0; k < z->s->img_n; ++k) {
+         z->img_comp[k].x = (z->img_comp[k].x + round) >> z->scale_shift;
+         z->img_comp[k].y = (z->img_comp[k].y + round) >> z->scale_shift;
+      }
    }
+
+   // determine actual number of components to generate
+   output = stbi__jpeg_output(z, req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1, flip);
+   stbi__cleanup_jpeg(z);
+   if (!output) return NULL;
+   *out_x = z->s->img_x;
+   *out_y = z->s->img_y;
+   if (comp) *comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+   return output;
 }
 
 static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
 {
    unsigned char* result;
    stbi__jpeg* j = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
-   STBI_NOTUSED(ri);
    j->s = s;
    stbi__setup_jpeg(j);
-   result = load_jpeg_image(j, x,y,comp,req_comp);
+   s->scale_shift = 0; // scaled here rather than afterwards
+   result = load_jpeg_image(j, x,y,comp,req_comp, stbi__vertically_flip_on_load);
+   ri->flipped = stbi__vertically_flip_on_load;
    STBI_FREE(j);
    return result;
 }
@@ -3840,6 +5342,17 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
    STBI_FREE(j);
    return result;
 }
+
+static int stbi__jpeg_is_progressive(stbi__context *s)
+{
+   int result;
+   stbi__jpeg* j = (stbi__jpeg*) (stbi__malloc(sizeof(stbi__jpeg)));
+   if (!j) return 0;
+   j->s = s;
+   result = stbi__decode_jpeg_header(j, STBI__SCAN_header) && j->progressive;
+   STBI_FREE(j);
+   return result;
+}
 #endif
 
 // public domain zlib decode    v0.2  Sean Barrett 2006-11-18
@@ -3852,7 +5365,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
-#define STBI__ZFAST_BITS  9 // accelerate all cases in default tables
+#define STBI__ZFAST_BITS  11 // accelerate all cases in default tables, and nearly all in real streams
 #define STBI__ZFAST_MASK  ((1 << STBI__ZFAST_BITS) - 1)
 
 // zlib-style huffman encoding
@@ -3937,11 +5450,17 @@ static int stbi__zbuild_huffman(stbi__zhuffman *z, const stbi_uc *sizelist, int
 //    we require PNG read all the IDATs and combine them into a single
 //    memory buffer
 
+// the bit buffer is refilled a word at a time where the byte order allows it
+#if defined(STBI__X86_TARGET) || defined(STBI__X64_TARGET) || (defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+#define STBI__ZWORD_REFILL
+#endif
+
 typedef struct
 {
    stbi_uc *zbuffer, *zbuffer_end;
    int num_bits;
-   stbi__uint32 code_buffer;
+   int zero_bytes; // fed into code_buffer past zbuffer_end
+   stbi__uint64 code_buffer; // bits above num_bits are undefined
 
    char *zout;
    char *zout_start;
@@ -3957,20 +5476,35 @@ stbi_inline static stbi_uc stbi__zget8(stbi__zbuf *z)
    return *z->zbuffer++;
 }
 
+// tops the bit buffer up to at least 56 bits, which covers a literal/length
+// code, a distance code and both extra bit fields without another refill
 static void stbi__fill_bits(stbi__zbuf *z)
 {
-   do {
-      STBI_ASSERT(z->code_buffer < (1U << z->num_bits));
-      z->code_buffer |= (unsigned int) stbi__zget8(z) << z->num_bits;
+#ifdef STBI__ZWORD_REFILL
+   if (z->zbuffer_end - z->zbuffer >= 8) {
+      // load 8 bytes but only consume the whole ones that fit. the rest of
+      // the word lands above num_bits, where the next refill puts the same
+      // bytes again, so the OR there is harmless.
+      stbi__uint64 word;
+      memcpy(&word, z->zbuffer, 8);
+      z->code_buffer |= word << z->num_bits;
+      z->zbuffer += (63 - z->num_bits) >> 3;
+      z->num_bits |= 56;
+      return;
+   }
+#endif
+   while (z->num_bits <= 56) {
+      if (z->zbuffer >= z->zbuffer_end) ++z->zero_bytes;
+      z->code_buffer |= (stbi__uint64) stbi__zget8(z) << z->num_bits;
       z->num_bits += 8;
-   } while (z->num_bits <= 24);
+   }
 }
 
 stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 {
    unsigned int k;
    if (z->num_bits < n) stbi__fill_bits(z);
-   k = z->code_buffer & ((1 << n) - 1);
+   k = (unsigned int) (z->code_buffer & ((1 << n) - 1));
    z->code_buffer >>= n;
    z->num_bits -= n;
    return k;
@@ -3981,7 +5515,7 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
    int b,s,k;
    // not resolved by fast table, so compute it the slow way
    // use jpeg approach, which requires MSbits at top
-   k = stbi__bit_reverse(a->code_buffer, 16);
+   k = stbi__bit_reverse((int) (a->code_buffer & 0xffff), 16);
    for (s=STBI__ZFAST_BITS+1; ; ++s)
       if (k < z->maxcode[s])
          break;
@@ -3998,7 +5532,7 @@ stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
 {
    int b,s;
    if (a->num_bits < 16) stbi__fill_bits(a);
-   b = z->fast[a->code_buffer & STBI__ZFAST_MASK];
+   b = z->fast[(int) (a->code_buffer & STBI__ZFAST_MASK)];
    if (b) {
       s = b >> 9;
       a->code_buffer >>= s;
@@ -4055,7 +5589,7 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          *zout++ = (char) z;
       } else {
          stbi_uc *p;
-         int len,dist;
+         int len,dist,k;
          if (z == 256) {
             a->zout = zout;
             return 1;
@@ -4074,8 +5608,28 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
          }
          p = (stbi_uc *) (zout - dist);
          if (dist == 1) { // run of one byte; common in images.
-            stbi_uc v = *p;
-            if (len) { do *zout++ = v; while (--len); }
+            memset(zout, *p, len);
+            zout += len;
+         } else if (a->zout_end - zout >= len + 8) {
+            // 8 bytes at a time, from at least 8 bytes back so that a word never
+            // reads bytes it writes itself. a shorter distance repeats its bytes,
+            // so once the first few are out the same data is a multiple of it
+            // back. the last word may spill up to 7 bytes past the match into
+            // free space.
+            char *end = zout + len;
+            int step = dist, head;
+            while (step < 8) step += dist;
+            head = step - dist < len ? step - dist : len;
+            for (k=0; k < head; ++k)
+               zout[k] = p[k];
+            zout += head;
+            p = (stbi_uc *) zout - step;
+            while (zout < end) {
+               memcpy(zout, p, 8);
+               zout += 8;
+               p += 8;
+            }
+            zout = end;
          } else {
             if (len) { do *zout++ = *p++; while (--len); }
          }
@@ -4138,17 +5692,16 @@ static int stbi__parse_uncompressed_block(stbi__zbuf *a)
    int len,nlen,k;
    if (a->num_bits & 7)
       stbi__zreceive(a, a->num_bits & 7); // discard
-   // drain the bit-packed data into header
-   k = 0;
-   while (a->num_bits > 0) {
-      header[k++] = (stbi_uc) (a->code_buffer & 255); // suppress MSVC run-time check
-      a->code_buffer >>= 8;
-      a->num_bits -= 8;
-   }
-   STBI_ASSERT(a->num_bits == 0);
-   // now fill header the normal way
-   while (k < 4)
-      header[k++] = stbi__zget8(a);
+   // hand the whole bytes still in the bit buffer back to the input. the zeros
+   // fed in past its end are the newest bytes, so they are dropped instead.
+   k = (a->num_bits >> 3) - a->zero_bytes;
+   if (k > 0) a->zbuffer -= k;
+   a->num_bits = 0;
+   a->code_buffer = 0;
+   a->zero_bytes = 0;
+   // now read the header from the input
+   for (k=0; k < 4; ++k)
+      header[k] = stbi__zget8(a);
    len  = header[1] * 256 + header[0];
    nlen = header[3] * 256 + header[2];
    if (nlen != (len ^ 0xffff)) return stbi__err("zlib corrupt","Corrupt PNG");
@@ -4210,6 +5763,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
       if (!stbi__parse_zlib_header(a)) return 0;
    a->num_bits = 0;
    a->code_buffer = 0;
+   a->zero_bytes = 0;
    do {
       final = stbi__zreceive(a,1);
       type = stbi__zreceive(a,2);
@@ -4356,6 +5910,7 @@ typedef struct
    stbi__context *s;
    stbi_uc *idata, *expanded, *out;
    int depth;
+   int flip; // write the image bottom-up
 } stbi__png;
 
 
@@ -4392,8 +5947,146 @@ static int stbi__paeth(int a, int b, int c)
 
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
+#ifdef STBI_SSE2
+// one 3 or 4 byte pixel in the low bytes of a register
+stbi_inline static __m128i stbi__png_load_pixel(const stbi_uc *p, int n)
+{
+   int v;
+   if (n == 4) memcpy(&v, p, 4);
+   else v = p[0] | (p[1] << 8) | (p[2] << 16);
+   return _mm_cvtsi32_si128(v);
+}
+
+stbi_inline static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int n)
+{
+   int x = _mm_cvtsi128_si32(v);
+   if (n == 4) {
+      memcpy(p, &x, 4);
+   } else {
+      p[0] = (stbi_uc) x;
+      p[1] = (stbi_uc) (x >> 8);
+      p[2] = (stbi_uc) (x >> 16);
+   }
+}
+
+#ifdef STBI_AVX2
+STBI__AVX2_TARGET
+static int stbi__png_unfilter_up_avx2(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int n)
+{
+   int k;
+   for (k=0; k+32 <= n; k += 32) {
+      __m256i x = _mm256_loadu_si256((const __m256i *) (raw + k));
+      __m256i b = _mm256_loadu_si256((const __m256i *) (prior + k));
+      _mm256_storeu_si256((__m256i *) (cur + k), _mm256_add_epi8(x, b));
+   }
+   return k;
+}
+#endif
+
+// unfilter a row of 8-bit pixels with 3 or 4 channels below another row. the
+// filters that depend on the pixel to the left go a pixel per step, with the
+// channels side by side in one register. out_n is img_n, or img_n+1 to add
+// an opaque alpha channel.
+stbi_inline static void stbi__png_unfilter_pixels(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int filter, int width, int img_n, int out_n, int level)
+{
+   __m128i zero  = _mm_setzero_si128();
+   __m128i one   = _mm_set1_epi8(1);
+   __m128i alpha = _mm_cvtsi32_si128(img_n != out_n ? (int) 0xff000000 : 0);
+   __m128i a = zero, c = zero; // decoded pixel to the left, and the one above it
+   int i,k;
+
+   switch (filter) {
+      case STBI__F_none:
+         for (i=0; i < width; ++i, raw += img_n, cur += out_n)
+            stbi__png_store_pixel(cur, _mm_or_si128(stbi__png_load_pixel(raw, img_n), alpha), out_n);
+         break;
+
+      case STBI__F_sub:
+         for (i=0; i < width; ++i, raw += img_n, cur += out_n) {
+            a = _mm_add_epi8(a, stbi__png_load_pixel(raw, img_n));
+            stbi__png_store_pixel(cur, _mm_or_si128(a, alpha), out_n);
+         }
+         break;
+
+      case STBI__F_up:
+         if (img_n == out_n) {
+            // no dependency between bytes at all
+            int n = width*img_n;
+            k = 0;
+#ifdef STBI_AVX2
+            if (level >= STBI_simd_avx2)
+               k = stbi__png_unfilter_up_avx2(cur, prior, raw, n);
+#endif
+            for (; k+16 <= n; k += 16) {
+               __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+               __m128i b = _mm_loadu_si128((const __m128i *) (prior + k));
+               _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+            }
+            for (; k < n; ++k)
+               cur[k] = STBI__BYTECAST(raw[k] + prior[k]);
+         } else {
+            for (i=0; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+               __m128i b = stbi__png_load_pixel(prior, img_n);
+               stbi__png_store_pixel(cur, _mm_or_si128(_mm_add_epi8(b, stbi__png_load_pixel(raw, img_n)), alpha), out_n);
+            }
+         }
+         break;
+
+      case STBI__F_avg:
+         for (i=0; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+            // avg_epu8 rounds up; take the carry back off where a+b is odd
+            __m128i b = stbi__png_load_pixel(prior, img_n);
+            __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+            a = _mm_add_epi8(avg, stbi__png_load_pixel(raw, img_n));
+            stbi__png_store_pixel(cur, _mm_or_si128(a, alpha), out_n);
+         }
+         break;
+
+      case STBI__F_paeth:
+         for (i=0; i < width; ++i, raw += img_n, cur += out_n, prior += out_n) {
+            // stbi__paeth in 16-bit lanes: with p = a+b-c, p-a = b-c, p-b = a-c
+            // and p-c = (b-c) + (a-c). ties go to a, then b, as there.
+            __m128i b   = stbi__png_load_pixel(prior, img_n);
+            __m128i a16 = _mm_unpacklo_epi8(a, zero);
+            __m128i b16 = _mm_unpacklo_epi8(b, zero);
+            __m128i c16 = _mm_unpacklo_epi8(c, zero);
+            __m128i pa  = _mm_sub_epi16(b16, c16);
+            __m128i pb  = _mm_sub_epi16(a16, c16);
+            __m128i pc  = _mm_add_epi16(pa, pb);
+            __m128i smallest, use_a, use_b, nearest;
+            pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+            pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+            pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+            smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+            use_a = _mm_cmpeq_epi16(smallest, pa);
+            use_b = _mm_andnot_si128(use_a, _mm_cmpeq_epi16(smallest, pb));
+            nearest = _mm_or_si128(_mm_and_si128(use_a, a16), _mm_and_si128(use_b, b16));
+            nearest = _mm_or_si128(nearest, _mm_andnot_si128(_mm_or_si128(use_a, use_b), c16));
+            a = _mm_add_epi8(_mm_packus_epi16(nearest, zero), stbi__png_load_pixel(raw, img_n));
+            c = b;
+            stbi__png_store_pixel(cur, _mm_or_si128(a, alpha), out_n);
+         }
+         break;
+   }
+   STBI_NOTUSED(level);
+}
+
+static void stbi__png_unfilter_row_simd(stbi_uc *cur, const stbi_uc *prior, const stbi_uc *raw, int filter, int width, int img_n, int out_n, int level)
+{
+   // constant channel counts turn the pixel loads and stores into plain moves
+   if (img_n == 4)
+      stbi__png_unfilter_pixels(cur, prior, raw, filter, width, 4, 4, level);
+   else if (out_n == 4)
+      stbi__png_unfilter_pixels(cur, prior, raw, filter, width, 3, 4, level);
+   else
+      stbi__png_unfilter_pixels(cur, prior, raw, filter, width, 3, 3, level);
+}
+#endif
+
 // create the png data from post-deflated data
-static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color)
+// with flip the rows are stored bottom-up, each filtered against the row after it
+// in memory; the later per-pixel passes don't care about the order
+static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 raw_len, int out_n, stbi__uint32 x, stbi__uint32 y, int depth, int color, int flip)
 {
    int bytes = (depth == 16? 2 : 1);
    stbi__context *s = a->s;
@@ -4405,6 +6098,9 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int output_bytes = out_n*bytes;
    int filter_bytes = img_n*bytes;
    int width = x;
+#ifdef STBI_SSE2
+   int simd = stbi_get_simd_level();
+#endif
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
    a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
@@ -4420,7 +6116,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    if (raw_len < img_len) return stbi__err("not enough pixels","Corrupt PNG");
 
    for (j=0; j < y; ++j) {
-      stbi_uc *cur = a->out + stride*j;
+      stbi_uc *cur = a->out + stride*(flip ? y-1-j : j);
       stbi_uc *prior;
       int filter = *raw++;
 
@@ -4433,7 +6129,16 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          filter_bytes = 1;
          width = img_width_bytes;
       }
-      prior = cur - stride; // bugfix: need to compute this after 'cur +=' computation above
+      prior = flip ? cur + stride : cur - stride; // bugfix: need to compute this after 'cur +=' computation above
+
+#ifdef STBI_SSE2
+      // rows of 8-bit RGB and RGBA below the first, the usual bulk of a big image
+      if (simd >= STBI_simd_sse2 && depth == 8 && (img_n == 3 || img_n == 4) && j > 0) {
+         stbi__png_unfilter_row_simd(cur, prior, raw, filter, width, img_n, out_n, simd);
+         raw += width*img_n;
+         continue;
+      }
+#endif
 
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
@@ -4509,7 +6214,7 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
          // the loop above sets the high byte of the pixels' alpha, but for
          // 16 bit png files we also need the low byte set. we'll do that here.
          if (depth == 16) {
-            cur = a->out + stride*j; // start at the beginning of the row again
+            cur = a->out + stride*(flip ? y-1-j : j); // start at the beginning of the row again
             for (i=0; i < x; ++i,cur+=output_bytes) {
                cur[filter_bytes+1] = 255;
             }
@@ -4612,7 +6317,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
    stbi_uc *final;
    int p;
    if (!interlaced)
-      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
+      return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color, a->flip);
 
    // de-interlacing
    final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
@@ -4627,7 +6332,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       y = (a->s->img_y - yorig[p] + yspc[p]-1) / yspc[p];
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
-         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
+         if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color, 0)) {
             STBI_FREE(final);
             return 0;
          }
@@ -4635,6 +6340,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
             for (i=0; i < x; ++i) {
                int out_y = j*yspc[p]+yorig[p];
                int out_x = i*xspc[p]+xorig[p];
+               if (a->flip) out_y = a->s->img_y-1 - out_y;
                memcpy(final + out_y*a->s->img_x*out_bytes + out_x*out_bytes,
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
@@ -4970,7 +6676,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
 {
    void *result=NULL;
    if (req_comp < 0 || req_comp > 4) return stbi__errpuc("bad req_comp", "Internal error");
+   p->flip = stbi__vertically_flip_on_load;
    if (stbi__parse_png_file(p, STBI__SCAN_load, req_comp)) {
+      ri->flipped = p->flip;
       if (p->depth < 8)
          ri->bits_per_channel = 8;
       else
@@ -4979,9 +6687,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       p->out = NULL;
       if (req_comp && req_comp != p->s->img_out_n) {
          if (ri->bits_per_channel == 8)
-            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format((unsigned char *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, NULL);
          else
-            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y);
+            result = stbi__convert_format16((stbi__uint16 *) result, p->s->img_out_n, req_comp, p->s->img_x, p->s->img_y, NULL);
          p->s->img_out_n = req_comp;
          if (result == NULL) return result;
       }
@@ -5222,6 +6930,11 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    flip_vertically = ((int) s->img_y) > 0;
    s->img_y = abs((int) s->img_y);
+   // a flipped load is a change of which rows get swapped below
+   if (stbi__vertically_flip_on_load) {
+      flip_vertically = !flip_vertically;
+      ri->flipped = 1;
+   }
 
    mr = info.mr;
    mg = info.mg;
@@ -5373,7 +7086,7 @@ static void *stbi__bmp_load(stbi__context *s, int *x, int *y, int *comp, int req
    }
 
    if (req_comp && req_comp != target) {
-      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y);
+      out = stbi__convert_format(out, target, req_comp, s->img_x, s->img_y, NULL);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
 
@@ -5555,6 +7268,11 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
       tga_is_RLE = 1;
    }
    tga_inverted = 1 - ((tga_inverted >> 5) & 1);
+   // a flipped load is a change of which rows get inverted below
+   if (stbi__vertically_flip_on_load) {
+      tga_inverted = !tga_inverted;
+      ri->flipped = 1;
+   }
 
    //   If I'm paletted, then I'll use the number of bits from the palette
    if ( tga_indexed ) tga_comp = stbi__tga_get_comp(tga_palette_bits, 0, &tga_rgb16);
@@ -5704,7 +7422,7 @@ static void *stbi__tga_load(stbi__context *s, int *x, int *y, int *comp, int req
 
    // convert to target component count
    if (req_comp && req_comp != tga_comp)
-      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height);
+      tga_data = stbi__convert_format(tga_data, tga_comp, req_comp, tga_width, tga_height, NULL);
 
    //   the things I do to get rid of an error message, and yet keep
    //   Microsoft's C compilers happy... [8^(
@@ -5949,9 +7667,9 @@ static void *stbi__psd_load(stbi__context *s, int *x, int *y, int *comp, int req
    // convert to desired output format
    if (req_comp && req_comp != 4) {
       if (ri->bits_per_channel == 16)
-         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h);
+         out = (stbi_uc *) stbi__convert_format16((stbi__uint16 *) out, 4, req_comp, w, h, ri);
       else
-         out = stbi__convert_format(out, 4, req_comp, w, h);
+         out = stbi__convert_format(out, 4, req_comp, w, h, ri);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
 
@@ -6166,7 +7884,7 @@ static void *stbi__pic_load(stbi__context *s,int *px,int *py,int *comp,int req_c
    *px = x;
    *py = y;
    if (req_comp == 0) req_comp = *comp;
-   result=stbi__convert_format(result,4,req_comp,x,y);
+   result=stbi__convert_format(result,4,req_comp,x,y,ri);
 
    return result;
 }
@@ -6631,7 +8349,7 @@ static void *stbi__load_gif_main(stbi__context *s, int **delays, int *x, int *y,
 
       // do the final conversion after loading everything; 
       if (req_comp && req_comp != 4)
-         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h);
+         out = stbi__convert_format(out, 4, req_comp, layers * g.w, g.h, NULL);
 
       *z = layers; 
       return out;
@@ -6656,7 +8374,7 @@ static void *stbi__gif_load(stbi__context *s, int *x, int *y, int *comp, int req
       // moved conversion to after successful load so that the same
       // can be done for multiple frames. 
       if (req_comp && req_comp != 4)
-         u = stbi__convert_format(u, 4, req_comp, g.w, g.h);
+         u = stbi__convert_format(u, 4, req_comp, g.w, g.h, ri);
    } else if (g.out) {
       // if there was an error and we allocated an image buffer, free it!
       STBI_FREE(g.out);
@@ -7110,7 +8828,7 @@ static void *stbi__pnm_load(stbi__context *s, int *x, int *y, int *comp, int req
    stbi__getn(s, out, s->img_n * s->img_x * s->img_y);
 
    if (req_comp && req_comp != s->img_n) {
-      out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y);
+      out = stbi__convert_format(out, s->img_n, req_comp, s->img_x, s->img_y, ri);
       if (out == NULL) return out; // stbi__convert_format frees input on failure
    }
    return out;
@@ -7318,6 +9036,19 @@ STBIDEF int stbi_is_16_bit_from_callbacks(stbi_io_callbacks const *c, void *user
    return stbi__is_16_main(&s);
 }
 
+STBIDEF int stbi_is_progressive_from_memory(stbi_uc const *buffer, int len)
+{
+#ifndef STBI_NO_JPEG
+   stbi__context s;
+   stbi__start_mem(&s,buffer,len);
+   if (stbi__jpeg_test(&s)) return stbi__jpeg_is_progressive(&s);
+#else
+   STBI_NOTUSED(buffer);
+   STBI_NOTUSED(len);
+#endif
+   return 0;
+}
+
 #endif // STB_IMAGE_IMPLEMENTATION
 
 /*
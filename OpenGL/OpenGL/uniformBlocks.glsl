@@ -0,0 +1,10 @@
+layout (std140) uniform Camera
+{
+	mat4 view;
+	mat4 projection;
+};
+
+layout (std140) uniform Object
+{
+	mat4 model;
+};
\ No newline at end of file
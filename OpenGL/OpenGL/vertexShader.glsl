@@ -4,9 +4,7 @@ layout (location = 1) in vec2 aTexCoord;
 
 out vec2 TexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#include "uniformBlocks.glsl"
 
 void main()
 {